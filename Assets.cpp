@@ -0,0 +1,529 @@
+#include "Assets.hpp"
+#include "load_save_png.hpp"
+#include "encode_tile.hpp"
+#include "pack_palettes.hpp"
+#include "level_csv.hpp"
+
+#include <filesystem>
+#include <cstring>
+#include <algorithm>
+#include <regex>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+#define ERROR(msg) std::cerr << "[ERROR] (" << __FILE__ ":" << __LINE__ << ") " << msg << std::endl
+
+void import_assets(std::string const &path, Assets *assets_) {
+	assert(assets_);
+	auto &tiles = assets_->tiles;
+	auto &palettes = assets_->palettes;
+	auto &spriteData = assets_->spriteData;
+	auto &mapData = assets_->mapData;
+
+	//Collect first because of animation frames
+	std::unordered_map<std::string, int8_t> animGroups;
+
+	const std::regex exp("(.*)_(\\d+)\\.png$");
+	for (const auto& itr : std::filesystem::directory_iterator(path + "/sprites")) {
+		if (itr.path().extension() != ".png") continue;
+
+		std::string filename = itr.path().filename().string();
+		std::smatch match;
+
+		if (std::regex_match(filename, match, exp)) {
+			std::string base = match[1].str();
+			if (animGroups.find(base) == animGroups.end()) {
+				animGroups[base] = 0;
+			}
+			animGroups[base] = std::max(animGroups[base], int8_t(std::stoi(match[2].str())));
+		} else {
+			animGroups[itr.path().stem().string()] = 0;
+		}
+	}
+
+	//Decode and quantize every frame in parallel (each frame is independent),
+	// then merge them in order so global tile and palette indices don't depend on thread timing:
+	struct Frame {
+		std::string path;
+		glm::uvec2 size = glm::uvec2(0);
+		//one per 8x8 tile, in row-major order:
+		std::vector<EncodedTile> tiles;
+		std::vector<std::string> errors; //reported during the merge, so they come out in order
+		std::exception_ptr exception;
+	};
+	std::vector<std::pair<std::string, int8_t>> groups(animGroups.begin(), animGroups.end());
+	std::vector<Frame> frames;
+	for (const auto& [name, lastFrame] : groups) {
+		for (int8_t i = 0; i <= lastFrame; i++) {
+			frames.emplace_back().path = path + "/sprites/" + name + ((lastFrame == 0) ? "" : ("_" + std::to_string(i))) + ".png";
+		}
+	}
+
+	auto decodeFrame = [](Frame& frame) {
+		std::vector<glm::u8vec4> data;
+		glm::uvec2& size = frame.size;
+		load_png(frame.path, &size, &data, OriginLocation::LowerLeftOrigin);
+
+		for (size_t ty = 0; ty < size.y / 8; ++ty) {
+			for (size_t tx = 0; tx < size.x / 8; ++tx) {
+				EncodedTile encoded = encode_tile(&data[(ty * 8) * size.x + (tx * 8)], size.x);
+				if (encoded.extra_pixels) {
+					glm::uvec2 at = glm::uvec2(tx * 8 + encoded.first_extra.x, ty * 8 + encoded.first_extra.y);
+					glm::u8vec4 color = data[at.y * size.x + at.x];
+					frame.errors.emplace_back("More than 4 colors in " + frame.path
+						+ ": tile (" + std::to_string(tx) + ", " + std::to_string(ty) + ") has " + std::to_string(encoded.extra_pixels)
+						+ " pixel(s) that don't fit, first at pixel (" + std::to_string(at.x) + ", " + std::to_string(at.y) + ") from the bottom left"
+						+ " with color (" + std::to_string(color.r) + ", " + std::to_string(color.g) + ", " + std::to_string(color.b) + ", " + std::to_string(color.a) + ")");
+				}
+				frame.tiles.emplace_back(encoded);
+			}
+		}
+	};
+
+	{
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			for (size_t f = next++; f < frames.size(); f = next++) {
+				try {
+					decodeFrame(frames[f]);
+				} catch (...) {
+					frames[f].exception = std::current_exception();
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		size_t count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), frames.size());
+		for (size_t t = 1; t < count; ++t) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+
+	//Palettes are chosen once every frame is decoded, so tiles can share them as much as possible:
+	// first collect the distinct sets of colors tiles use (in order, so the result is deterministic)...
+	std::vector<ColorSet> colorSets;
+	std::unordered_map<ColorSet, size_t, ColorSet::Hash> colorSetIndices;
+	std::vector<std::vector<size_t>> frameColorSets(frames.size()); //per tile of every frame, index in colorSets
+	for (size_t f = 0; f < frames.size(); ++f) {
+		if (frames[f].exception) std::rethrow_exception(frames[f].exception);
+		for (const auto& error : frames[f].errors) {
+			ERROR(error);
+		}
+		for (const auto& encoded : frames[f].tiles) {
+			ColorSet set = ColorSet::from_palette(encoded.palette, encoded.colors);
+			auto [it, inserted] = colorSetIndices.emplace(set, colorSets.size());
+			if (inserted) colorSets.emplace_back(set);
+			frameColorSets[f].emplace_back(it->second);
+		}
+	}
+
+	//...then pack them into as few palettes as possible:
+	std::vector<size_t> colorSetPalettes;
+	size_t paletteStart = palettes.size();
+	{
+		std::vector<PPU466::Palette> packed = pack_palettes(colorSets, &colorSetPalettes);
+		palettes.insert(palettes.end(), packed.begin(), packed.end());
+	}
+
+	//tiles already in the table, by contents:
+	auto tileKey = [](const PPU466::Tile& tile) -> std::string_view {
+		return std::string_view(reinterpret_cast<const char*>(&tile), sizeof(tile));
+	};
+	std::unordered_map<std::string_view, size_t> tileTable;
+	//(keys point into 'tiles', so make sure it never reallocates:)
+	size_t tileCount = 0;
+	for (const auto& frame : frames) tileCount += frame.tiles.size();
+	tiles.reserve(tiles.size() + tileCount);
+
+	//find a tile or one of its mirror images in the table, giving its index and the flip that turns it into 'tile':
+	// (returns tiles.size() if it isn't there)
+	auto findTile = [&](const PPU466::Tile& tile) -> std::pair<size_t, uint8_t> {
+		auto reverseBits = [](uint8_t b) -> uint8_t {
+			b = uint8_t(((b & 0xf0) >> 4) | ((b & 0x0f) << 4));
+			b = uint8_t(((b & 0xcc) >> 2) | ((b & 0x33) << 2));
+			return uint8_t(((b & 0xaa) >> 1) | ((b & 0x55) << 1));
+		};
+		for (uint8_t flip : {uint8_t(0), uint8_t(PPU466::FlipX), uint8_t(PPU466::FlipY), uint8_t(PPU466::FlipX | PPU466::FlipY)}) {
+			PPU466::Tile flipped;
+			for (size_t y = 0; y < 8; ++y) {
+				size_t from = (flip & PPU466::FlipY) ? 7 - y : y;
+				flipped.bit0[y] = (flip & PPU466::FlipX) ? reverseBits(tile.bit0[from]) : tile.bit0[from];
+				flipped.bit1[y] = (flip & PPU466::FlipX) ? reverseBits(tile.bit1[from]) : tile.bit1[from];
+			}
+			auto it = tileTable.find(tileKey(flipped));
+			if (it != tileTable.end()) return std::make_pair(it->second, flip); //(flips are their own inverse)
+		}
+		return std::make_pair(tiles.size(), uint8_t(0));
+	};
+
+	auto frame = frames.begin();
+	for (const auto& [name, lastFrame] : groups) {
+		SpriteData& d = spriteData[name];
+		d.frames = lastFrame + 1;
+		size_t tilesBefore = tiles.size();
+		for (int8_t i = 0; i <= lastFrame; i++, ++frame) {
+			if (i == 0) {
+				d.width = uint8_t(frame->size.x / 8);
+				d.height = uint8_t(frame->size.y / 8);
+			}
+
+			for (size_t t = 0; t < frame->tiles.size(); ++t) {
+				PPU466::Tile tile = frame->tiles[t].tile;
+				const PPU466::Palette& palette = frame->tiles[t].palette;
+				size_t count = frame->tiles[t].colors;
+
+				size_t paletteIndex = paletteStart + colorSetPalettes[frameColorSets[frame - frames.begin()][t]];
+
+				{ //the tile's colors are somewhere in its (shared) palette; renumber the tile's pixels to match:
+					const PPU466::Palette& actualPalette = palettes[paletteIndex];
+					std::array<uint8_t, 4> remap = {0, 0, 0, 0};
+					for (size_t local = 0; local < count; ++local) {
+						size_t index = 0;
+						for (; index < 4; ++index) {
+							if (actualPalette[index] == palette[local]) break;
+						}
+						assert(index < 4);
+						remap[local] = uint8_t(index);
+					}
+					for (size_t y = 0; y < 8; ++y) {
+						uint8_t bit0 = 0, bit1 = 0;
+						for (size_t x = 0; x < 8; ++x) {
+							size_t index = remap[((tile.bit0[y] >> x) & 1) | (((tile.bit1[y] >> x) & 1) << 1)];
+							bit0 |= index & 1 ? (1 << x) : 0;
+							bit1 |= index & 2 ? (1 << x) : 0;
+						}
+						tile.bit0[y] = bit0;
+						tile.bit1[y] = bit1;
+					}
+				}
+
+				//share tiles that are identical to (or mirror images of) ones already in the table:
+				auto [tileIndex, flip] = findTile(tile);
+				if (tileIndex == tiles.size()) {
+					tiles.push_back(tile);
+					tileTable.emplace(tileKey(tiles.back()), tileIndex);
+				}
+				d.tileIndices.emplace_back(tileIndex);
+				d.paletteIndices.emplace_back(paletteIndex);
+				d.tileFlips.emplace_back(flip);
+			}
+		}
+
+		std::cout << "Loaded " << name << ": " << (int)d.frames << " frames, " << d.tileIndices.size() << " tiles (" << (tiles.size() - tilesBefore) << " new)" << std::endl;
+	}
+	std::cout << "Total tiles: " << tiles.size() << std::endl;
+	std::cout << "Total palettes: " << palettes.size() << " (for " << colorSets.size() << " different sets of tile colors)" << std::endl;
+
+	//each level cell names a sprite; its first tile is what goes there:
+	LevelCells cells;
+	cells.reserve(spriteData.size());
+	//sprites that can't go in a level cell get placeholder values instead, so using one in a level can be reported:
+	// (bits 13-15 are never set in a real cell, so Unencodable | i stands for unencodable[i])
+	constexpr uint16_t Unencodable = 0xE000;
+	std::vector<std::string_view> unencodable;
+	for (const auto& [name, data] : spriteData) {
+		//level cells hold global tile and palette indices in PPU466 background format, so only the first 256 tiles and 8 palettes fit:
+		if (data.tileIndices[0] > 0xFF || data.paletteIndices[0] > 0x07) {
+			cells.emplace(name, uint16_t(Unencodable | std::min<size_t>(unencodable.size(), 0x1FFF)));
+			unencodable.emplace_back(name);
+			continue;
+		}
+		uint8_t tile = uint8_t(data.tileIndices[0]);
+		uint8_t palette = uint8_t(data.paletteIndices[0]);
+		uint8_t flip = data.tileFlips[0];
+		cells.emplace(name, uint16_t(tile | ((palette | flip) << 8))); //FIXME
+	}
+
+	std::vector<bool> usedCells(0x10000, false); //(by every level)
+	for (const auto& itr : std::filesystem::directory_iterator(path + "/levels")) {
+		if (itr.path().extension() != ".csv") continue;
+
+		MappedFile file(itr.path().string());
+		MapData& map = mapData[itr.path().stem().string()];
+		parse_level_csv(file.data(), cells, itr.path().string(), &map);
+
+		for (size_t i = 0; i < map.tiles.size(); ++i) {
+			if ((map.tiles[i] & Unencodable) != Unencodable) continue;
+			const SpriteData& data = spriteData.at(std::string(unencodable[map.tiles[i] & 0x1FFF]));
+			throw std::runtime_error(itr.path().string() + ":" + std::to_string(i / map.width + 1) + ": column " + std::to_string(i % map.width)
+				+ " uses '" + std::string(unencodable[map.tiles[i] & 0x1FFF]) + "' (tile " + std::to_string(data.tileIndices[0]) + ", palette " + std::to_string(data.paletteIndices[0])
+				+ "), but level cells can only refer to the first 256 tiles and 8 palettes.");
+		}
+		for (uint16_t cell : map.tiles) {
+			usedCells[cell] = true;
+		}
+	}
+
+	//sprites that entities might draw over a level -- everything but the single tiles levels are made of:
+	SpriteResidency sprites;
+	sprites.tiles.assign(tiles.size(), false);
+	sprites.palettes.assign(palettes.size(), false);
+	for (const auto& [name, data] : spriteData) {
+		if (data.width * data.height == 1 && data.frames == 1 && usedCells[cells.at(name)]) continue;
+		for (size_t tile : data.tileIndices) sprites.tiles[tile] = true;
+		for (size_t palette : data.paletteIndices) sprites.palettes[palette] = true;
+	}
+
+	//every screenful of every level, plus those sprites, has to fit in the PPU's tables at once (better to find out now than in game):
+	// (less the blank slots PlayMode keeps for itself)
+	constexpr uint32_t TileSlots = BlankTileSlot;
+	constexpr uint32_t PaletteSlots = BlankPaletteSlot;
+	for (auto& [name, map] : mapData) {
+		std::string filename = path + "/levels/" + name + ".csv";
+		LevelResidency& plan = map.residency;
+		plan = plan_level_residency(map, sprites);
+		if (plan.peakTiles > TileSlots) {
+			throw std::runtime_error(filename + ": columns " + std::to_string(plan.peakTilesColumn) + "-" + std::to_string(plan.peakTilesColumn + LevelScreenColumns - 1)
+				+ " and sprites can be on screen together and need " + std::to_string(plan.peakTiles) + " different tiles; only " + std::to_string(TileSlots) + " fit (the PPU's last tile slot is kept blank).");
+		}
+		if (plan.peakPalettes > PaletteSlots) {
+			throw std::runtime_error(filename + ": columns " + std::to_string(plan.peakPalettesColumn) + "-" + std::to_string(plan.peakPalettesColumn + LevelScreenColumns - 1)
+				+ " and sprites can be on screen together and need " + std::to_string(plan.peakPalettes) + " different palettes; only " + std::to_string(PaletteSlots) + " fit (the PPU's last palette slot is kept blank).");
+		}
+
+		std::cout << "Loaded \"" << name << ".csv\": " << map.width << " wide, " << (map.width ? map.tiles.size() / map.width : 0) << " tall"
+			<< ", at most " << plan.peakTiles << " tiles and " << plan.peakPalettes << " palettes on screen with sprites (" << plan.peakTileLoads << " tile loads per column scrolled)" << std::endl;
+	}
+}
+
+//pack layout:
+// "tile" -- every tile
+// "pal0" -- every palette
+// "str0" -- sprite and level names, concatenated
+// "spr0" -- one PackedSprite per sprite
+// "sprt" -- one PackedSpriteTile per tile of every sprite, concatenated
+// "map1" -- one PackedMap per level
+// "mapt" or "mapz" -- one per AssetPack::LevelPageColumns columns of each level (named in the table of contents "<level>/<page>"),
+//   that page's tiles, row by row from the top ("mapz" is a compressed chunk, used when compression makes the page smaller)
+// table of contents (see read_write_chunk.hpp)
+struct PackedSprite {
+	uint32_t name_begin, name_end; //range in "str0"
+	uint32_t tiles_begin, tiles_end; //range in "sprt"
+	uint8_t width, height;
+	uint8_t frames;
+	uint8_t padding = 0;
+};
+static_assert(sizeof(PackedSprite) == 20, "PackedSprite is packed");
+
+struct PackedSpriteTile {
+	uint32_t tile; //index in "tile"
+	uint16_t palette; //index in "pal0"
+	uint8_t flip; //PPU466::FlipX / FlipY bits
+	uint8_t padding = 0;
+};
+static_assert(sizeof(PackedSpriteTile) == 8, "PackedSpriteTile is packed");
+
+struct PackedMap {
+	uint32_t name_begin, name_end; //range in "str0"
+	uint16_t width, height;
+	uint16_t peak_tiles, peak_tile_loads; //see LevelResidency
+	uint8_t peak_palettes;
+	uint8_t padding[3] = {0, 0, 0};
+};
+static_assert(sizeof(PackedMap) == 20, "PackedMap is packed");
+
+static std::string map_page_name(std::string const &name, uint32_t page) {
+	return name + "/" + std::to_string(page);
+}
+
+void write_assets_pack(Assets const &assets, std::ostream *to_) {
+	assert(to_);
+	auto &to = *to_;
+
+	std::vector< char > names;
+	auto add_name = [&names](std::string const &name, uint32_t *begin, uint32_t *end) {
+		*begin = uint32_t(names.size());
+		names.insert(names.end(), name.begin(), name.end());
+		*end = uint32_t(names.size());
+	};
+
+	//sprite names go first, in spriteData order (the "spr0" loop below relies on this):
+	for (auto const &[name, data] : assets.spriteData) {
+		names.insert(names.end(), name.begin(), name.end());
+	}
+
+	std::vector< PackedMap > maps;
+	maps.reserve(assets.mapData.size());
+	for (auto const &[name, data] : assets.mapData) {
+		PackedMap &map = maps.emplace_back();
+		add_name(name, &map.name_begin, &map.name_end);
+		map.width = data.width;
+		map.height = uint16_t(data.width ? data.tiles.size() / data.width : 0);
+		map.peak_tiles = uint16_t(data.residency.peakTiles);
+		map.peak_tile_loads = uint16_t(std::min< uint32_t >(data.residency.peakTileLoads, 0xffff));
+		map.peak_palettes = uint8_t(data.residency.peakPalettes);
+	}
+
+	//(names are padded to a multiple of four bytes so that the chunks after them stay aligned for AssetPack)
+	names.resize((names.size() + 3) / 4 * 4, '\0');
+
+	ChunkTOC toc;
+	write_chunk("tile", "", assets.tiles, &to, &toc);
+	write_chunk("pal0", "", assets.palettes, &to, &toc);
+	write_chunk("str0", "", names, &to, &toc);
+
+	//sprites are written straight from assets.spriteData, without building packed copies first:
+	ChunkWriter sprites("spr0", "", &to, &toc);
+	uint32_t name_begin = 0;
+	uint32_t tiles_begin = 0;
+	for (auto const &[name, data] : assets.spriteData) {
+		PackedSprite sprite;
+		sprite.name_begin = name_begin;
+		sprite.name_end = name_begin + uint32_t(name.size());
+		name_begin = sprite.name_end;
+		sprite.tiles_begin = tiles_begin;
+		sprite.tiles_end = tiles_begin + uint32_t(data.tileIndices.size());
+		tiles_begin = sprite.tiles_end;
+		sprite.width = data.width;
+		sprite.height = data.height;
+		sprite.frames = data.frames;
+		sprites.write(sprite);
+	}
+	sprites.close();
+
+	ChunkWriter sprite_tiles("sprt", "", &to, &toc);
+	for (auto const &[name, data] : assets.spriteData) {
+		assert(data.paletteIndices.size() == data.tileIndices.size());
+		assert(data.tileFlips.size() == data.tileIndices.size());
+		for (size_t i = 0; i < data.tileIndices.size(); ++i) {
+			PackedSpriteTile tile;
+			tile.tile = uint32_t(data.tileIndices[i]);
+			tile.palette = uint16_t(data.paletteIndices[i]);
+			tile.flip = data.tileFlips[i];
+			sprite_tiles.write(tile);
+		}
+	}
+	sprite_tiles.close();
+
+	write_chunk("map1", "", maps, &to, &toc);
+	for (auto const &[name, data] : assets.mapData) {
+		uint32_t height = uint32_t(data.width ? data.tiles.size() / data.width : 0);
+		std::vector< uint16_t > page;
+		for (uint32_t column = 0, index = 0; column < data.width; column += AssetPack::LevelPageColumns, ++index) {
+			uint32_t columns = std::min< uint32_t >(AssetPack::LevelPageColumns, data.width - column);
+			page.clear();
+			for (uint32_t row = 0; row < height; ++row) {
+				auto begin = data.tiles.begin() + row * data.width + column;
+				page.insert(page.end(), begin, begin + columns);
+			}
+			//levels are mostly repeated tiles, so pages are usually much smaller compressed:
+			std::vector< char > compressed = compress_chunk_data(page);
+			if (compressed.size() < page.size() * sizeof(uint16_t)) {
+				write_chunk("mapz", map_page_name(name, index), compressed, &to, &toc);
+			} else {
+				write_chunk("mapt", map_page_name(name, index), page, &to, &toc);
+			}
+		}
+	}
+	write_toc(toc, &to);
+}
+
+AssetPack::AssetPack(std::string const &filename, bool verify_checksums_) : file(filename), verify_checksums(verify_checksums_) {
+	if (!read_toc(file.data(), &toc)) {
+		throw std::runtime_error("Asset pack '" + filename + "' has no table of contents.");
+	}
+	verified = std::make_unique< std::atomic< bool >[] >(toc.entries.size());
+	for (size_t i = 0; i < toc.entries.size(); ++i) {
+		verified[i].store(false, std::memory_order_relaxed);
+	}
+
+	std::span<char const> names;
+	std::span<PackedSprite const> sprites;
+	std::span<PackedSpriteTile const> sprite_tiles;
+	std::span<PackedMap const> maps;
+
+	read_chunk("tile", "", &tiles);
+	read_chunk("pal0", "", &palettes);
+	read_chunk("str0", "", &names);
+	read_chunk("spr0", "", &sprites);
+	read_chunk("sprt", "", &sprite_tiles);
+	read_chunk("map1", "", &maps);
+
+	auto get_name = [&names](uint32_t begin, uint32_t end) {
+		if (!(begin <= end && end <= names.size())) {
+			throw std::runtime_error("Asset pack has out-of-range name.");
+		}
+		return std::string(names.data() + begin, names.data() + end);
+	};
+
+	for (PackedSprite const &sprite : sprites) {
+		if (!(sprite.tiles_begin <= sprite.tiles_end && sprite.tiles_end <= sprite_tiles.size())) {
+			throw std::runtime_error("Asset pack has out-of-range sprite tiles.");
+		}
+		SpriteData &data = spriteData[get_name(sprite.name_begin, sprite.name_end)];
+		data.width = sprite.width;
+		data.height = sprite.height;
+		data.frames = sprite.frames;
+		for (PackedSpriteTile const &tile : sprite_tiles.subspan(sprite.tiles_begin, sprite.tiles_end - sprite.tiles_begin)) {
+			if (tile.tile >= tiles.size() || tile.palette >= palettes.size()) {
+				throw std::runtime_error("Asset pack has out-of-range sprite tile.");
+			}
+			data.tileIndices.emplace_back(tile.tile);
+			data.paletteIndices.emplace_back(tile.palette);
+			data.tileFlips.emplace_back(tile.flip);
+		}
+	}
+
+	//levels are only listed here; their pages are looked up (and so paged in) by read_map_page:
+	for (PackedMap const &map : maps) {
+		MapInfo &info = mapInfos[get_name(map.name_begin, map.name_end)];
+		info.width = map.width;
+		info.height = map.height;
+		info.peakTiles = map.peak_tiles;
+		info.peakTileLoads = map.peak_tile_loads;
+		info.peakPalettes = map.peak_palettes;
+	}
+}
+
+template< typename T >
+void AssetPack::read_chunk(std::string const &magic, std::string_view name, std::span<T const> *to) const {
+	ChunkTOC::Entry const *entry = toc.find(magic, name);
+	if (!entry) {
+		throw std::runtime_error("Asset pack is missing '" + magic + "' chunk '" + std::string(name) + "'.");
+	}
+	std::span<char const> from = chunk_data(*entry);
+	::read_chunk(&from, magic, to);
+}
+
+std::span<char const> AssetPack::chunk_data(ChunkTOC::Entry const &entry) const {
+	size_t index = size_t(&entry - toc.entries.data());
+	assert(index < toc.entries.size());
+	if (verify_checksums && !verified[index].load(std::memory_order_acquire)) {
+		verify_chunk(file.data(), entry);
+		verified[index].store(true, std::memory_order_release);
+	}
+	//(ending the span at the chunk's end keeps a bad header from sending ::read_chunk past it, even unverified)
+	return file.data().subspan(entry.offset, 8 + size_t(entry.size));
+}
+
+bool AssetPack::read_map_page(std::string const &name, uint32_t page, std::vector< uint16_t > *tiles) const {
+	assert(tiles);
+	auto it = mapInfos.find(name);
+	if (it == mapInfos.end() || page >= it->second.pages()) return false;
+	uint32_t columns = std::min< uint32_t >(LevelPageColumns, it->second.width - page * LevelPageColumns);
+
+	std::string page_name = map_page_name(name, page);
+	if (ChunkTOC::Entry const *entry = toc.find("mapt", page_name)) {
+		//(read as bytes: pages follow compressed chunks of any size, so they may not be 2-byte aligned)
+		std::span< char const > from = chunk_data(*entry);
+		std::span< char const > stored;
+		::read_chunk(&from, "mapt", &stored);
+		tiles->resize(stored.size() / sizeof(uint16_t));
+		std::memcpy(tiles->data(), stored.data(), tiles->size() * sizeof(uint16_t));
+	} else {
+		ChunkTOC::Entry const *compressed = toc.find("mapz", page_name);
+		if (!compressed) {
+			throw std::runtime_error("Asset pack is missing level data for '" + page_name + "'.");
+		}
+		std::span< char const > from = chunk_data(*compressed);
+		read_compressed_chunk(&from, "mapz", tiles);
+	}
+	if (tiles->size() != size_t(columns) * it->second.height) {
+		throw std::runtime_error("Asset pack has level page '" + page_name + "' of the wrong size.");
+	}
+	return true;
+}
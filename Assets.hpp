@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+ * Assets -- the game's tiles, palettes, sprites, and levels.
+ *
+ * The source assets (PNGs in assets/sprites and CSVs in assets/levels) are
+ * imported at build time by the 'bake-assets' tool and saved as a pack of
+ * chunks (see read_write_chunk.hpp), which the game maps into memory at startup.
+ *
+ */
+
+#include "PPU466.hpp"
+#include "level_residency.hpp"
+#include "mapped_file.hpp"
+#include "read_write_chunk.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SpriteData {
+	uint8_t width, height;
+	uint8_t frames;
+	//per tile of every frame (frame-major, then row-major from the bottom left):
+	// identical and mirrored tiles share one entry in 'tiles', so tileFlips gives the PPU466::FlipX / FlipY bits to draw with
+	std::vector<size_t> tileIndices;
+	std::vector<size_t> paletteIndices;
+	std::vector<uint8_t> tileFlips;
+};
+
+struct MapData {
+	uint16_t width;
+	std::vector<uint16_t> tiles;
+	LevelResidency residency; //(worked out by import_assets)
+};
+
+struct Assets {
+	std::vector<PPU466::Tile> tiles;
+	std::vector<PPU466::Palette> palettes;
+	std::unordered_map<std::string, SpriteData> spriteData;
+	std::unordered_map<std::string, MapData> mapData;
+};
+
+//decode every sprite in 'path'/sprites and every level in 'path'/levels into 'assets':
+// (this is the slow part -- PNG decoding and quantization -- so the game doesn't do it at runtime)
+void import_assets(std::string const &path, Assets *assets);
+
+//save assets as a pack of chunks:
+void write_assets_pack(Assets const &assets, std::ostream *to);
+
+//AssetPack is a pack written by write_assets_pack, mapped into memory:
+// tiles and palettes point directly into the mapped file (no copies)
+// chunks are found through the pack's table of contents, so level pages that are never loaded are never read
+//  (not even to check their checksums, which happens when a chunk is first read)
+struct AssetPack {
+	//NOTE: throws on missing or malformed pack
+	// also checks each chunk against its checksum the first time it is read (and throws if it doesn't match),
+	// unless verify_checksums is false (only sensible for trusted files)
+	explicit AssetPack(std::string const &filename, bool verify_checksums = true);
+
+	//the spans below point into this:
+	MappedFile file;
+	ChunkTOC toc;
+
+	std::span<PPU466::Tile const> tiles;
+	std::span<PPU466::Palette const> palettes;
+	std::unordered_map<std::string, SpriteData> spriteData;
+
+	//levels are stored in pages of this many columns (the last page of a level may be narrower),
+	// so they can be loaded a piece at a time (see LevelStream):
+	static constexpr uint32_t LevelPageColumns = 32;
+
+	struct MapInfo {
+		uint16_t width = 0, height = 0;
+		//most tiles / palettes the level and sprites need on screen at once, and most tiles loaded per column scrolled (see LevelResidency):
+		uint16_t peakTiles = 0, peakTileLoads = 0;
+		uint8_t peakPalettes = 0;
+		uint32_t pages() const { return (uint32_t(width) + LevelPageColumns - 1) / LevelPageColumns; }
+	};
+	//size of every level, by name:
+	std::unordered_map<std::string, MapInfo> mapInfos;
+
+	//read page 'page' of level 'name' -- its columns, row by row from the top -- into 'tiles':
+	// returns false if there is no such level or page (throws if the page's data is malformed)
+	// (only reads the pack, so it's fine to call from several threads at once)
+	bool read_map_page(std::string const &name, uint32_t page, std::vector<uint16_t> *tiles) const;
+
+private:
+	template< typename T >
+	void read_chunk(std::string const &magic, std::string_view name, std::span<T const> *to) const;
+
+	//entry's chunk (header and data, and nothing past it), checking it against the entry if that hasn't been done yet:
+	std::span<char const> chunk_data(ChunkTOC::Entry const &entry) const;
+
+	bool verify_checksums;
+	//which toc.entries have passed their checksum check:
+	// (atomic since read_map_page is called from several threads; at worst two threads both check the same chunk)
+	std::unique_ptr< std::atomic< bool >[] > verified;
+};
@@ -111,26 +111,124 @@ if (maek.OS === 'windows') {
 // cppFile: name of c++ file to compile
 // objFileBase (optional): base name object file to produce (if not supplied, set to options.objDir + '/' + cppFile without the extension)
 //returns objFile: objFileBase + a platform-dependant suffix ('.o' or '.obj')
-const game_objs = [
-	maek.CPP('PlayMode.cpp'),
+//(objects used by more than one executable are compiled once and shared:)
+const assets_obj = maek.CPP('Assets.cpp');
+const encode_tile_obj = maek.CPP('encode_tile.cpp');
+const pack_palettes_obj = maek.CPP('pack_palettes.cpp');
+const level_csv_obj = maek.CPP('level_csv.cpp');
+const level_residency_obj = maek.CPP('level_residency.cpp');
+const load_save_png_obj = maek.CPP('load_save_png.cpp');
+const mapped_file_obj = maek.CPP('mapped_file.cpp');
+const lz_block_obj = maek.CPP('lz_block.cpp');
+const crc32c_obj = maek.CPP('crc32c.cpp');
+const decode_tile_obj = maek.CPP('decode_tile.cpp');
+
+//the PPU and what it needs to link (PPU466::draw uses OpenGL, but PPU466::rasterize doesn't need a context):
+const ppu_objs = [
 	maek.CPP('PPU466.cpp'),
-	maek.CPP('main.cpp'),
-	maek.CPP('load_save_png.cpp'),
+	maek.CPP('PPU466_rasterize.cpp'),
+	decode_tile_obj,
 	maek.CPP('Load.cpp'),
-	maek.CPP('data_path.cpp'),
-	maek.CPP('Mode.cpp'),
 	maek.CPP('gl_compile_program.cpp'),
 	maek.CPP('GL.cpp')
 ];
 
+const game_objs = [
+	maek.CPP('PlayMode.cpp'),
+	maek.CPP('level_stream.cpp'),
+	maek.CPP('slot_residency.cpp'),
+	...ppu_objs,
+	assets_obj,
+	encode_tile_obj,
+	pack_palettes_obj,
+	level_csv_obj,
+	level_residency_obj,
+	mapped_file_obj,
+	lz_block_obj,
+	crc32c_obj,
+	maek.CPP('main.cpp'),
+	load_save_png_obj,
+	maek.CPP('data_path.cpp'),
+	maek.CPP('Mode.cpp')
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
 const game_exe = maek.LINK(game_objs, 'dist/game');
 
-//set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, ...copies];
+//the asset baking tool imports sprites and levels into the pack the game loads:
+// (the importer and png loader are shared with the game's objects above)
+const bake_assets_exe = maek.LINK([
+	maek.CPP('bake-assets.cpp'),
+	assets_obj,
+	encode_tile_obj,
+	pack_palettes_obj,
+	level_csv_obj,
+	level_residency_obj,
+	mapped_file_obj,
+	lz_block_obj,
+	crc32c_obj,
+	load_save_png_obj,
+], 'bake-assets');
+
+//the '[targets =] RULE(targets, prerequisites, recipe)' runs commands to make files:
+// targets: array of files produced
+// prerequisites: array of files (or other targets) needed
+// recipe: array of commands to run; each is an array of strings
+//returns targets
+const asset_files = [];
+for (const dir of ['assets/sprites', 'assets/levels']) {
+	for (const file of require('fs').readdirSync(dir).sort()) {
+		asset_files.push(`${dir}/${file}`);
+	}
+}
+const asset_pack = maek.RULE(['dist/assets.pack'], [bake_assets_exe, ...asset_files], [
+	[`./${bake_assets_exe}`, 'assets', 'dist/assets.pack']
+]);
+
+//tests aren't built by default; build and run them with 'node Maekfile.js :test':
+// (each test exits non-zero on failure, which fails the build)
+const decode_tile_test_exe = maek.LINK([
+	maek.CPP('decode-tile-test.cpp'),
+	decode_tile_obj,
+], 'decode-tile-test');
+//rasterize-test compares PPU466::rasterize's output for a few fixed scenes against the images in tests/rasterize:
+// (after a change that's meant to alter them, run './rasterize-test tests/rasterize --update' and check the new images)
+// with '--gl' it compares PPU466::draw's output instead, which needs a GPU -- so that's a separate target, ':test-gl'
+const rasterize_test_exe = maek.LINK([
+	maek.CPP('rasterize-test.cpp'),
+	...ppu_objs,
+	load_save_png_obj,
+], 'rasterize-test');
+//asset-pack-test checks that damage to any chunk of the baked pack (header or data) stops it from loading:
+const asset_pack_test_exe = maek.LINK([
+	maek.CPP('asset-pack-test.cpp'),
+	assets_obj,
+	encode_tile_obj,
+	pack_palettes_obj,
+	level_csv_obj,
+	level_residency_obj,
+	mapped_file_obj,
+	lz_block_obj,
+	crc32c_obj,
+	load_save_png_obj,
+], 'asset-pack-test');
+const rasterize_goldens = require('fs').readdirSync('tests/rasterize').sort()
+	.filter(file => file.endsWith('.png') && !file.endsWith('-failed.png'))
+	.map(file => `tests/rasterize/${file}`);
+maek.RULE([':test'], [decode_tile_test_exe, rasterize_test_exe, ...rasterize_goldens, asset_pack_test_exe, ...asset_pack], [
+	[`./${decode_tile_test_exe}`],
+	[`./${rasterize_test_exe}`, 'tests/rasterize'],
+	[`./${asset_pack_test_exe}`, 'dist/assets.pack', 'objs/asset-pack-test.pack']
+]);
+maek.RULE([':test-gl'], [rasterize_test_exe, ...rasterize_goldens], [
+	[`./${rasterize_test_exe}`, 'tests/rasterize', '--gl']
+]);
+
+//set the default target to the game (and copy the readme files, and bake the assets):
+maek.TARGETS = [game_exe, ...asset_pack, ...copies];
 
 //======================================================================
 //Now, onward to the code that makes all this work:
@@ -390,6 +488,44 @@ function init_maek() {
 	};
 
 
+	//maek.RULE runs a list of commands that make some files from other files:
+	// targets is an array of files the commands produce
+	// prerequisites is an array of files (or other targets) the commands read
+	// recipe is an array of commands, each an array of strings (the first being the program to run)
+	maek.RULE = (targets, prerequisites, recipe) => {
+		if (!Array.isArray(targets) || targets.length === 0) throw new Error("RULE: targets should be a non-empty array.");
+		if (!Array.isArray(prerequisites)) throw new Error("RULE: prerequisites should be an array.");
+		if (!Array.isArray(recipe)) throw new Error("RULE: recipe should be an array of commands.");
+
+		const task = async () => {
+			for (const target of targets) {
+				await fsPromises.mkdir(path.dirname(target), { recursive: true });
+			}
+			for (const command of recipe) {
+				await run(command, `${task.label}: ${command[0]}`,
+					async () => {
+						return {
+							read:[...prerequisites],
+							written:[...targets]
+						};
+					}
+				);
+			}
+		};
+
+		task.depends = [...prerequisites];
+		task.label = `RULE ${targets.join(' ')}`;
+
+		for (const target of targets) {
+			if (target in maek.tasks) {
+				throw new Error(`Task ${task.label} purports to create ${target}, but ${maek.tasks[target].label} already creates that file.`);
+			}
+			maek.tasks[target] = task;
+		}
+
+		return targets;
+	};
+
 	//says something went wrong in building -- should fail loudly:
 	class BuildError extends Error {
 		constructor(message) {
@@ -577,6 +713,10 @@ function init_maek() {
 	// (used by run to figure out what to hash)
 	async function findExe(command) {
 		const osPath = require('path');
+		//commands given as paths (e.g. tools built by this Maekfile) aren't looked up in the system path:
+		if (command[0].includes('/')) {
+			return osPath.resolve(command[0]);
+		}
 		let PATH;
 		if (maek.OS === 'windows') {
 			PATH = process.env.PATH.split(';');
@@ -4,10 +4,13 @@
 #include "GL.hpp"
 #include "gl_compile_program.hpp"
 #include "gl_errors.hpp"
+#include "decode_tile.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
 #include <vector>
+#include <cstring>
+#include <stdexcept>
 
 //In order to implement the PPU466 on modern graphics hardware, a fancy, special purpose tile-drawing shader is used:
 struct PPUTileProgram {
@@ -23,15 +26,66 @@ struct PPUTileProgram {
 
 	//Uniform (per-invocation variable) locations:
 	GLuint OBJECT_TO_CLIP_mat4 = -1U;
+	GLuint PLANAR_TILES_bool = -1U;
 
 	//Textures bindings:
 	//TEXTURE0 - the tile table (as a 128x128 R8UI texture)
 	//TEXTURE1 - the palette table (as a 4x8 RGBA8 texture)
+	//TEXTURE3 - the tile table (as a 16x16 RGBA32UI texture of raw tiles; used if PLANAR_TILES is set)
 };
 
 //Initialize tile program and associated buffers:
 Load< PPUTileProgram > tile_program(LoadTagEarly); //will 'new PPUTileProgram()' by default
 
+//The instanced variant of the tile program draws each tile as an instance of one quad:
+// (its fragment shader is identical to PPUTileProgram's; only the vertex shader differs)
+struct PPUInstancedTileProgram {
+	PPUInstancedTileProgram();
+	~PPUInstancedTileProgram();
+
+	GLuint program = 0;
+
+	//Attribute (per-instance variable) locations:
+	GLuint Position_ivec2 = -1U;
+	GLuint TileIndex_uint = -1U;
+	GLuint Palette_uint = -1U;
+	GLuint Flip_uint = -1U;
+
+	//Uniform (per-invocation variable) locations:
+	GLuint OBJECT_TO_CLIP_mat4 = -1U;
+	GLuint PLANAR_TILES_bool = -1U;
+
+	//Textures bindings:
+	//TEXTURE0 - the tile table (as a 128x128 R8UI texture)
+	//TEXTURE1 - the palette table (as a 4x8 RGBA8 texture)
+	//TEXTURE3 - the tile table (as a 16x16 RGBA32UI texture of raw tiles; used if PLANAR_TILES is set)
+};
+
+Load< PPUInstancedTileProgram > instanced_tile_program(LoadTagEarly);
+
+//The tilemap program draws the whole background layer as one screen-covering quad:
+struct PPUTilemapProgram {
+	PPUTilemapProgram();
+	~PPUTilemapProgram();
+
+	GLuint program = 0;
+
+	//(no attributes -- the quad is generated from gl_VertexID)
+
+	//Uniform (per-invocation variable) locations:
+	GLuint OBJECT_TO_CLIP_mat4 = -1U;
+	GLuint BACKGROUND_POSITION_ivec2 = -1U;
+	GLuint PLANAR_TILES_bool = -1U;
+
+	//Textures bindings:
+	//TEXTURE0 - the tile table (as a 128x128 R8UI texture)
+	//TEXTURE1 - the palette table (as a 4x8 RGBA8 texture)
+	//TEXTURE2 - the background (as a 64x60 R16UI texture)
+	//TEXTURE3 - the tile table (as a 16x16 RGBA32UI texture of raw tiles; used if PLANAR_TILES is set)
+};
+
+Load< PPUTilemapProgram > tilemap_program(LoadTagEarly);
+
 //PPU data is streamed to the GPU (read: uploaded 'just in time') using a few buffers:
 struct PPUDataStream {
 	PPUDataStream();
@@ -48,17 +102,102 @@ struct PPUDataStream {
 		int32_t Palette;
 	};
 
+	//instance format for convenience:
+	// (one of these replaces the six Vertex-es of a tile when drawing with PPU466::DrawInstanced)
+	struct Instance {
+		Instance(glm::ivec2 const &Position_, uint8_t TileIndex_, uint8_t Palette_, uint8_t Flip_)
+			: Position(Position_), TileIndex(TileIndex_), Palette(Palette_), Flip(Flip_) { }
+		glm::i16vec2 Position; //lower-left corner of the tile on the screen
+		uint8_t TileIndex;
+		uint8_t Palette;
+		uint8_t Flip; //PPU466::FlipX and/or PPU466::FlipY
+		uint8_t padding = 0; //(keeps instances 4-byte aligned)
+	};
+	static_assert(sizeof(Instance) == 8, "Instance is packed");
+
+	//the most tiles a single draw can produce (the whole background plus every sprite):
+	static constexpr uint32_t MaxTiles = PPU466::BackgroundWidth * PPU466::BackgroundHeight + std::tuple_size< decltype(PPU466::sprites) >::value;
+
+	//vertex_buffer and instance_buffer are allocated once, with room for RingSlices draws' worth of data:
+	// each draw writes the next slice in turn, while the GPU may still be reading earlier slices.
+	static constexpr uint32_t RingSlices = 3;
+	static constexpr size_t VertexSliceSize = 6 * MaxTiles * sizeof(Vertex);
+	static constexpr size_t InstanceSliceSize = MaxTiles * sizeof(Instance);
+
+	//claim the next slice, waiting if the GPU is still reading it from RingSlices draws ago:
+	uint32_t begin_slice() const;
+	//call after issuing the last draw that reads 'slice':
+	void end_slice(uint32_t slice) const;
+
+	//streaming state (mutable because PPU466::draw only gets to see a const PPUDataStream):
+	mutable uint32_t next_slice = 0;
+	mutable std::array< GLsync, RingSlices > slice_fences{}; //<-- signalled when the GPU is done reading each slice
+
+	//scratch storage for building the triangle strip (or instance list), re-used every draw:
+	mutable std::vector< Vertex > triangle_strip;
+	mutable std::vector< Instance > instances;
+
 	//vertex buffer that will store data stream:
 	GLuint vertex_buffer = 0;
 
 	//vertex array object that maps tile program attributes to vertex storage:
 	GLuint vertex_buffer_for_tile_program = 0;
 
+	//instance buffer that will store data stream when drawing instanced:
+	GLuint instance_buffer = 0;
+
+	//vertex array object that maps instanced tile program attributes to instance storage:
+	GLuint instance_buffer_for_instanced_tile_program = 0;
+
+	//(re-)point instanced tile program attributes at instance_buffer, starting 'offset' bytes in:
+	// (expects instance_buffer_for_instanced_tile_program to be bound)
+	void point_instance_attributes(size_t offset) const;
+
+	//vertex array object with no attributes at all (for the tilemap program's generated quad):
+	GLuint empty_vertex_array = 0;
+
 	//texture object that will store tile table:
 	GLuint tile_tex = 0;
 
 	//texture object that will store palette table:
 	GLuint palette_tex = 0;
+
+	//texture object that will store background (when drawing with PPU466::BackgroundTilemap):
+	GLuint background_tex = 0;
+
+	//texture object that will store the un-decoded tile table (when drawing with PPU466::TilesPlanar):
+	GLuint tile_bits_tex = 0;
+
+	//offscreen framebuffer + color texture the PPU's 256x240 screen is drawn into (when drawing with PPU466::UpscaleBlit):
+	GLuint screen_fb = 0;
+	GLuint screen_tex = 0;
+
+	//copies of the tile and palette tables as they were last uploaded to tile_tex and palette_tex:
+	// (mutable because PPU466::draw only gets to see a const PPUDataStream)
+	mutable struct {
+		bool valid = false; //<-- nothing uploaded yet
+		PPU466::TileFormat tile_format = PPU466::TilesIndexed; //<-- which tile texture tile_table went to
+		std::array< PPU466::Tile, 16 * 16 > tile_table;
+		std::array< PPU466::Palette, 8 > palette_table;
+		std::array< bool, 16 * 16 > tile_blank; //<-- true for tiles whose pixels are all color index 0
+		bool background_valid = false; //<-- background_tex doesn't hold 'background' yet
+		decltype(PPU466::background) background;
+	} uploaded;
+
+	//the rest of the PPU state that produced the image in screen_tex:
+	// (along with uploaded.tile_table and uploaded.palette_table)
+	mutable struct {
+		bool valid = false; //<-- screen_tex doesn't hold a PPU image
+		glm::u8vec3 background_color;
+		glm::ivec2 background_position;
+		decltype(PPU466::background) background;
+		decltype(PPU466::sprites) sprites;
+	} presented;
+
+	//does screen_tex already show exactly what 'ppu' would draw?
+	bool still_presents(PPU466 const &ppu) const;
+	//call after drawing 'ppu' (screen_tex holds its image only if it was drawn with PPU466::UpscaleBlit):
+	void remember_presented(PPU466 const &ppu) const;
 };
 
 Load< PPUDataStream > data_stream(LoadTagDefault);
@@ -91,6 +230,11 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 	GLint old_viewport[4];
 	glGetIntegerv(GL_VIEWPORT, old_viewport);
 
+	//...and may draw to an offscreen framebuffer, so save the current framebuffer as well:
+	GLint old_draw_framebuffer = 0, old_read_framebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &old_draw_framebuffer);
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &old_read_framebuffer);
+
 	//draw to whole drawable:
 	glViewport(0,0,drawable_size.x,drawable_size.y);
 
@@ -104,39 +248,209 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	//set up screen scaling:
+	// screen_lower_left / screen_size is the part of the drawable the PPU's screen should cover
+	glm::ivec2 screen_lower_left = glm::ivec2(0,0);
+	glm::ivec2 screen_size = glm::ivec2(drawable_size);
 	if (drawable_size.x < ScreenWidth || drawable_size.y < ScreenHeight) {
 		//if screen is too small, just do some inglorious pixel-mushing:
-		//(viewport is already set. nothing more to do.)
+		//(whole drawable. nothing more to do.)
 	} else {
 		//otherwise, do careful integer-multiple upscaling:
 		//largest size that will fit in the drawable:
 		const uint32_t scale = std::max( 1U, std::min(drawable_size.x / ScreenWidth, drawable_size.y / ScreenHeight) );
 
 		//compute lower left so that screen is centered:
-		const glm::ivec2 lower_left = glm::ivec2(
+		screen_lower_left = glm::ivec2(
 			(int32_t(drawable_size.x) - scale * int32_t(ScreenWidth)) / 2,
 			(int32_t(drawable_size.y) - scale * int32_t(ScreenHeight)) / 2
 		);
-		glViewport(lower_left.x, lower_left.y, scale * ScreenWidth, scale * ScreenHeight);
+		screen_size = glm::ivec2(scale * ScreenWidth, scale * ScreenHeight);
 	}
 
-	//build triangle strip representing background and sprites:
+	draw_stats = DrawStats();
+
+	//helper to copy the offscreen framebuffer to the screen area of the original framebuffer:
+	// (integer-multiple nearest-neighbor scaling, so this matches drawing directly at that size)
+	auto present_screen = [&]() {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, data_stream->screen_fb);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(old_draw_framebuffer));
+		glBlitFramebuffer(
+			0, 0, ScreenWidth, ScreenHeight,
+			screen_lower_left.x, screen_lower_left.y, screen_lower_left.x + screen_size.x, screen_lower_left.y + screen_size.y,
+			GL_COLOR_BUFFER_BIT, GL_NEAREST
+		);
+	};
+
+	//helper to put back viewport and framebuffers, since scaling code messes with them:
+	auto restore_state = [&]() {
+		glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(old_draw_framebuffer));
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(old_read_framebuffer));
+	};
+
+	//if nothing changed since the last frame was drawn offscreen, just show that frame again:
+	// (skips building geometry, uploading, and drawing; common for menus, pauses, and idle scenes)
+	if (upscale_path == UpscaleBlit && data_stream->still_presents(*this)) {
+		present_screen();
+		restore_state();
+		draw_stats.reused_previous_frame = true;
+		GL_ERRORS();
+		return;
+	}
 
-	constexpr uint32_t TristripSize = uint32_t(6 * (BackgroundWidth * BackgroundHeight + decltype(sprites)().size()));
-	std::vector< PPUDataStream::Vertex > triangle_strip;
-	triangle_strip.reserve(TristripSize);
+	if (upscale_path == UpscaleBlit) {
+		//draw at native resolution to the offscreen framebuffer (scaled up at the end):
+		glBindFramebuffer(GL_FRAMEBUFFER, data_stream->screen_fb);
+		glViewport(0, 0, ScreenWidth, ScreenHeight);
+		glClear(GL_COLOR_BUFFER_BIT);
+	} else {
+		//draw directly to the scaled-up area of the drawable:
+		glViewport(screen_lower_left.x, screen_lower_left.y, screen_size.x, screen_size.y);
+	}
+
+	//-------------------------------------------------
+	//Upload tile and palette tables to GPU using PPUDataStream:
+	// (done first because culling, below, uses information gathered while looking for changed tiles)
+
+	//tile and palette textures only get re-uploaded where they differ from what was uploaded last time:
+	// (on the first draw nothing has been uploaded yet, so everything differs)
+	auto &uploaded = data_stream->uploaded;
+
+	{ //upload changed rows of palette texture:
+		static_assert(sizeof(palette_table) == 4 * 4 * decltype(palette_table)().size(), "palette table is packed");
+		glBindTexture(GL_TEXTURE_2D, data_stream->palette_tex);
+		for (uint32_t i = 0; i < palette_table.size(); ++i) {
+			if (uploaded.valid && uploaded.palette_table[i] == palette_table[i]) continue;
+			uploaded.palette_table[i] = palette_table[i];
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, GLint(i), 4, 1, GL_RGBA, GL_UNSIGNED_BYTE, palette_table[i].data());
+			draw_stats.palettes_uploaded += 1;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	{ //build + upload changed tiles of tile table texture:
+		//interpret tiles and build a 128 x 128 index texture:
+		// (kept between frames, so only changed tiles need to be re-interpreted)
+		static std::array< uint8_t, 128 * 128 > data;
+
+		//changed tiles are re-interpreted, then uploaded as 8x8 regions:
+		static std::array< uint8_t, 16 * 16 > changed;
+		uint32_t changed_count = 0;
+
+		//the other format's texture may be stale, so switching formats re-uploads everything:
+		const bool upload_all = !uploaded.valid || uploaded.tile_format != tile_format;
+		uploaded.tile_format = tile_format;
+
+		for (uint32_t i = 0; i < tile_table.size(); ++i) {
+			Tile const &tile = tile_table[i];
+			if (!upload_all && std::memcmp(&uploaded.tile_table[i], &tile, sizeof(Tile)) == 0) continue;
+			uploaded.tile_table[i] = tile;
+			changed[changed_count++] = uint8_t(i);
+
+			//note whether every pixel of the tile is color 0:
+			uploaded.tile_blank[i] = true;
+			for (uint32_t y = 0; y < 8; ++y) {
+				if (tile.bit0[y] | tile.bit1[y]) uploaded.tile_blank[i] = false;
+			}
+
+			//planar tiles are uploaded as-is:
+			if (tile_format == TilesPlanar) continue;
+
+			//location of tile in the texture:
+			uint32_t ox = (i % 16) * 8;
+			uint32_t oy = (i / 16) * 8;
+
+			//copy tile indices into texture:
+			decode_tile(tile, data.data() + ox + 128 * oy, 128);
+		}
+
+		//past a certain point, one big upload is cheaper than many small ones:
+		constexpr uint32_t WholeTableThreshold = 64;
+
+		if (tile_format == TilesPlanar) {
+			//each texel of the 16x16 RGBA32UI planar texture is one whole tile:
+			static_assert(sizeof(tile_table) == 4 * 4 * 16 * 16, "tile table is packed");
+			glBindTexture(GL_TEXTURE_2D, data_stream->tile_bits_tex);
+			if (changed_count > WholeTableThreshold) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 16, 16, GL_RGBA_INTEGER, GL_UNSIGNED_INT, tile_table.data());
+			} else {
+				for (uint32_t c = 0; c < changed_count; ++c) {
+					glTexSubImage2D(GL_TEXTURE_2D, 0, changed[c] % 16, changed[c] / 16, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT, &tile_table[changed[c]]);
+				}
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+		} else {
+			glBindTexture(GL_TEXTURE_2D, data_stream->tile_tex);
+			if (changed_count > WholeTableThreshold) {
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 128, 128, GL_RED_INTEGER, GL_UNSIGNED_BYTE, data.data());
+			} else if (changed_count > 0) {
+				//tell GL that rows of the 8x8 regions are 128 bytes apart in 'data':
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 128);
+				for (uint32_t c = 0; c < changed_count; ++c) {
+					uint32_t ox = (changed[c] % 16) * 8;
+					uint32_t oy = (changed[c] / 16) * 8;
+					glTexSubImage2D(GL_TEXTURE_2D, 0, GLint(ox), GLint(oy), 8, 8, GL_RED_INTEGER, GL_UNSIGNED_BYTE, data.data() + ox + 128 * oy);
+				}
+				glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			}
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+
+		draw_stats.tiles_uploaded = changed_count;
+	}
+
+	uploaded.valid = true;
+
+	//-------------------------------------------------
+	//build triangle strip (or instance list) representing background and sprites:
+
+	//tiles that will be considered for drawing (some will get culled):
+	// (when drawing the background as a tilemap, only the sprites are tiles)
+	const uint32_t TileCount = uint32_t((background_path == BackgroundTiles ? BackgroundWidth * BackgroundHeight : 0) + sprites.size());
+	assert(TileCount <= PPUDataStream::MaxTiles);
+
+	//(storage is re-used from draw to draw, so building these doesn't allocate)
+	auto &triangle_strip = data_stream->triangle_strip;
+	auto &instances = data_stream->instances;
+	triangle_strip.clear();
+	instances.clear();
 
 	//helper to put a single tile somewhere on the screen:
-	auto draw_tile = [&triangle_strip](glm::ivec2 const &lower_left, uint8_t tile_index, uint8_t palette_index){
+	auto draw_tile = [this,&triangle_strip,&instances,&uploaded](glm::ivec2 const &lower_left, uint8_t tile_index, uint8_t palette_index, uint8_t flip){
+		//skip tiles that can't change any pixels:
+		if (lower_left.x <= -8 || lower_left.x >= int32_t(ScreenWidth) || lower_left.y <= -8 || lower_left.y >= int32_t(ScreenHeight)) {
+			//entirely off-screen
+			draw_stats.tiles_culled += 1;
+			return;
+		}
+		if (uploaded.tile_blank[tile_index] && palette_table[palette_index][0].a == 0) {
+			//every pixel is color 0, and color 0 is fully transparent (so blending leaves the framebuffer unchanged)
+			draw_stats.tiles_culled += 1;
+			return;
+		}
+		draw_stats.tiles_emitted += 1;
+
+		if (draw_path == DrawInstanced) {
+			//the vertex shader does the rest:
+			instances.emplace_back(lower_left, tile_index, palette_index, flip);
+			return;
+		}
+
 		//convert tile index to lower-left pixel coordinate in tile image:
 		glm::ivec2 tile_coord = glm::ivec2((tile_index % 16)*8, (tile_index / 16)*8);
 
+		//tile image coordinates of the quad's left/right and bottom/top edges (swapped to flip):
+		int32_t tile_left = tile_coord.x + ((flip & FlipX) ? 8 : 0);
+		int32_t tile_right = tile_coord.x + ((flip & FlipX) ? 0 : 8);
+		int32_t tile_bottom = tile_coord.y + ((flip & FlipY) ? 8 : 0);
+		int32_t tile_top = tile_coord.y + ((flip & FlipY) ? 0 : 8);
+
 		//build a quad as a (very short) triangle strip that starts and ends with degenerate triangles:
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x+0, lower_left.y+0), glm::ivec2(tile_coord.x+0, tile_coord.y+0), palette_index);
+		triangle_strip.emplace_back(glm::ivec2(lower_left.x+0, lower_left.y+0), glm::ivec2(tile_left, tile_bottom), palette_index);
 		triangle_strip.emplace_back(triangle_strip.back());
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x+0, lower_left.y+8), glm::ivec2(tile_coord.x+0, tile_coord.y+8), palette_index);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x+8, lower_left.y+0), glm::ivec2(tile_coord.x+8, tile_coord.y+0), palette_index);
-		triangle_strip.emplace_back(glm::ivec2(lower_left.x+8, lower_left.y+8), glm::ivec2(tile_coord.x+8, tile_coord.y+8), palette_index);
+		triangle_strip.emplace_back(glm::ivec2(lower_left.x+0, lower_left.y+8), glm::ivec2(tile_left, tile_top), palette_index);
+		triangle_strip.emplace_back(glm::ivec2(lower_left.x+8, lower_left.y+0), glm::ivec2(tile_right, tile_bottom), palette_index);
+		triangle_strip.emplace_back(glm::ivec2(lower_left.x+8, lower_left.y+8), glm::ivec2(tile_right, tile_top), palette_index);
 		triangle_strip.emplace_back(triangle_strip.back());
 	};
 
@@ -147,14 +461,24 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 			draw_tile(
 				glm::ivec2(sprite.x, sprite.y),
 				sprite.index,
-				sprite.attributes & 0x07 //just the palette index part
+				sprite.attributes & 0x07, //just the palette index part
+				sprite.attributes & (FlipX | FlipY) //and the flip part
 			);
 		}
 	};
 
+	//helper to count the tiles emitted so far:
+	auto tiles_so_far = [this,&triangle_strip,&instances]() -> uint32_t {
+		return uint32_t(draw_path == DrawInstanced ? instances.size() : triangle_strip.size() / 6);
+	};
+
 	draw_sprites(0x80); //draw sprites with priority == 1 ('behind' sprites)
 
-	{ //draw the background:
+	//tiles [0,behind_end) are behind the background and tiles [behind_end,end) are in front of it:
+	// (only matters when the background is drawn as a separate pass)
+	const uint32_t behind_end = tiles_so_far();
+
+	if (background_path == BackgroundTiles) { //draw the background:
 		//To simulate the 'infinite tiling' behavior this code draws the background as four screen-sized chunks,
 		// each of which is drawn at an offset that causes it to overlap the screen.
 
@@ -185,7 +509,8 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 						draw_tile(
 							glm::ivec2(pos.x + 8*x, pos.y + 8*y),
 							info & 0xff, //extract tile index bits
-							(info >> 8) & 0x07 //extract palette index bits
+							(info >> 8) & 0x07, //extract palette index bits
+							(info >> 8) & (FlipX | FlipY) //extract flip bits
 						);
 					}
 				}
@@ -196,47 +521,58 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 
 	draw_sprites(0x00); //draw sprites with priority == 0 ('in front' sprites)
 
-	assert(triangle_strip.size() == TristripSize && "Triangle strip size was estimated exactly.");
+	assert(draw_stats.tiles_emitted + draw_stats.tiles_culled == TileCount && "Tile count was estimated exactly.");
+	assert(tiles_so_far() == draw_stats.tiles_emitted);
 
 	//-------------------------------------------------
 	//Upload at to GPU using PPUDataStream:
 
-	{ //upload palette texture:
-		static_assert(sizeof(palette_table) == 4 * 4 * decltype(palette_table)().size(), "palette table is packed");
-		glBindTexture(GL_TEXTURE_2D, data_stream->palette_tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 4, GLsizei(palette_table.size()), 0, GL_RGBA, GL_UNSIGNED_BYTE, palette_table.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
-	}
-
-	{ //build + upload tile table texture:
-		//interpret tiles and build a 128 x 128 index texture:
-		static std::array< uint8_t, 128 * 128 > data;
-		for (uint32_t i = 0; i < tile_table.size(); ++i) {
-			Tile const &tile = tile_table[i];
-
-			//location of tile in the texture:
-			uint32_t ox = (i % 16) * 8;
-			uint32_t oy = (i / 16) * 8;
-
-			//copy tile indices into texture:
-			for (uint32_t y = 0; y < 8; ++y) {
-				for (uint32_t x = 0; x < 8; ++x) {
-					data[ox+x + 128 * (oy+y)] =
-						  ((tile.bit0[y] >> x) & 1)
-						| ((tile.bit1[y] >> x) & 1) << 1;
-				}
+	//(tile and palette tables were uploaded above)
+
+	//this frame's vertex (or instance) data goes in the next slice of the streaming ring:
+	const uint32_t slice = data_stream->begin_slice();
+
+	{ //upload vertex (or instance) data:
+		GLuint buffer;
+		size_t offset, size;
+		void const *src;
+		if (draw_path == DrawInstanced) {
+			buffer = data_stream->instance_buffer;
+			offset = slice * PPUDataStream::InstanceSliceSize;
+			size = sizeof(decltype(instances[0])) * instances.size();
+			src = instances.data();
+		} else {
+			buffer = data_stream->vertex_buffer;
+			offset = slice * PPUDataStream::VertexSliceSize;
+			size = sizeof(decltype(triangle_strip[0])) * triangle_strip.size();
+			src = triangle_strip.data();
+		}
+		if (size > 0) {
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			//begin_slice() already made sure the GPU is done with this slice, so no need for the driver to synchronize:
+			void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+			if (dst) {
+				std::memcpy(dst, src, size);
+				glUnmapBuffer(GL_ARRAY_BUFFER);
+			} else {
+				//(mapping shouldn't fail, but if it does this still works, just slower)
+				glBufferSubData(GL_ARRAY_BUFFER, offset, size, src);
 			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
-
-		glBindTexture(GL_TEXTURE_2D, data_stream->tile_tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, 128, 128, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, data.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 
-	{ //upload vertex data:
-		glBindBuffer(GL_ARRAY_BUFFER, data_stream->vertex_buffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(decltype(triangle_strip[0])) * triangle_strip.size(), triangle_strip.data(), GL_STREAM_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (background_path == BackgroundTilemap) { //upload background tilemap texture (if it changed):
+		// (background_tex is allocated once, in PPUDataStream's constructor, and only updated here)
+		static_assert(sizeof(background) == 2 * BackgroundWidth * BackgroundHeight, "background is packed");
+		if (!uploaded.background_valid || std::memcmp(&uploaded.background, &background, sizeof(background)) != 0) {
+			uploaded.background = background;
+			uploaded.background_valid = true;
+			glBindTexture(GL_TEXTURE_2D, data_stream->background_tex);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, BackgroundWidth, BackgroundHeight, GL_RED_INTEGER, GL_UNSIGNED_SHORT, background.data());
+			glBindTexture(GL_TEXTURE_2D, 0);
+			draw_stats.background_uploaded = true;
+		}
 	}
 
 	//set up the pipeline:
@@ -245,34 +581,88 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 	glBlendEquation(GL_FUNC_ADD);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// set the shader programs:
-	glUseProgram(tile_program->program);
-
-	// configure attribute streams:
-	glBindVertexArray(data_stream->vertex_buffer_for_tile_program);
-
-	// set uniforms for shader programs:
-	{ //set matrix to transform [0,ScreenWidth]x[0,ScreenHeight] -> [-1,1]x[-1,1]:
-		//NOTE: glm uses column-major matrices:
-		glm::mat4 OBJECT_TO_CLIP = glm::mat4(
-			glm::vec4(2.0f / float(ScreenWidth), 0.0f, 0.0f, 0.0f),
-			glm::vec4(0.0f, 2.0f / float(ScreenHeight), 0.0f, 0.0f),
-			glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
-			glm::vec4(-1.0f,-1.0f, 0.0f, 1.0f)
-		);
-		glUniformMatrix4fv(tile_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(OBJECT_TO_CLIP));
-	}
+	//matrix to transform [0,ScreenWidth]x[0,ScreenHeight] -> [-1,1]x[-1,1]:
+	//NOTE: glm uses column-major matrices:
+	const glm::mat4 OBJECT_TO_CLIP = glm::mat4(
+		glm::vec4(2.0f / float(ScreenWidth), 0.0f, 0.0f, 0.0f),
+		glm::vec4(0.0f, 2.0f / float(ScreenHeight), 0.0f, 0.0f),
+		glm::vec4(0.0f, 0.0f, 1.0f, 0.0f),
+		glm::vec4(-1.0f,-1.0f, 0.0f, 1.0f)
+	);
 
 	// bind texture units to proper texture objects:
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, data_stream->tile_bits_tex);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, data_stream->background_tex);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, data_stream->palette_tex);
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, data_stream->tile_tex);
 
-	//now that the pipeline is configured, trigger drawing of triangle strip:
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, GLsizei(triangle_strip.size()));
+	//helper to draw tiles [begin,end) of the triangle strip (or instance list):
+	auto draw_tiles = [&,this](uint32_t begin, uint32_t end) {
+		if (begin == end) return;
+		if (draw_path == DrawInstanced) {
+			glUseProgram(instanced_tile_program->program);
+			glUniformMatrix4fv(instanced_tile_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(OBJECT_TO_CLIP));
+			glUniform1i(instanced_tile_program->PLANAR_TILES_bool, tile_format == TilesPlanar);
+			glBindVertexArray(data_stream->instance_buffer_for_instanced_tile_program);
+			//OpenGL 3.3 can't start drawing at an instance offset, so move the attribute streams instead:
+			data_stream->point_instance_attributes(slice * PPUDataStream::InstanceSliceSize + begin * sizeof(PPUDataStream::Instance));
+			//(every instance is a four-vertex strip; instances are rasterized in order, so layering is unchanged)
+			glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(end - begin));
+		} else {
+			glUseProgram(tile_program->program);
+			glUniformMatrix4fv(tile_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(OBJECT_TO_CLIP));
+			glUniform1i(tile_program->PLANAR_TILES_bool, tile_format == TilesPlanar);
+			glBindVertexArray(data_stream->vertex_buffer_for_tile_program);
+			//(every tile starts and ends with a degenerate triangle, so it's safe to split the strip between tiles)
+			glDrawArrays(GL_TRIANGLE_STRIP, GLint(slice * 6 * PPUDataStream::MaxTiles + 6 * begin), GLsizei(6 * (end - begin)));
+		}
+	};
+
+	//now that the pipeline is configured, trigger drawing:
+	if (background_path == BackgroundTilemap) {
+		draw_tiles(0, behind_end);
+
+		//background is a single screen-covering quad; the fragment shader does all the tile lookups:
+		glUseProgram(tilemap_program->program);
+		glUniformMatrix4fv(tilemap_program->OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(OBJECT_TO_CLIP));
+		glUniform1i(tilemap_program->PLANAR_TILES_bool, tile_format == TilesPlanar);
+		{ //reduce background position to [0,BackgroundWidthPixels) x [0,BackgroundHeightPixels):
+			// (this way the shader's wrap-around math only needs to handle non-negative values)
+			constexpr int32_t BackgroundWidthPixels = int32_t(BackgroundWidth) * 8;
+			constexpr int32_t BackgroundHeightPixels = int32_t(BackgroundHeight) * 8;
+			glUniform2i(tilemap_program->BACKGROUND_POSITION_ivec2,
+				((background_position.x % BackgroundWidthPixels) + BackgroundWidthPixels) % BackgroundWidthPixels,
+				((background_position.y % BackgroundHeightPixels) + BackgroundHeightPixels) % BackgroundHeightPixels
+			);
+		}
+		glBindVertexArray(data_stream->empty_vertex_array);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		draw_tiles(behind_end, tiles_so_far());
+	} else {
+		draw_tiles(0, tiles_so_far());
+	}
+
+	//mark where the GPU will be done reading this frame's slice:
+	data_stream->end_slice(slice);
+
+	if (upscale_path == UpscaleBlit) {
+		present_screen();
+	}
+
+	//remember what the offscreen framebuffer now shows:
+	// (when drawing directly, it doesn't show anything useful)
+	data_stream->remember_presented(*this);
 
 	//return state to default:
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glActiveTexture(GL_TEXTURE0);
@@ -283,8 +673,8 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 
 	glDisable(GL_BLEND);
 
-	//also restore viewport, since earlier scaling code messed with it:
-	glViewport(old_viewport[0], old_viewport[1], old_viewport[2], old_viewport[3]);
+	//also restore viewport and framebuffers, since earlier scaling code messed with them:
+	restore_state();
 
 	GL_ERRORS();
 }
@@ -292,6 +682,44 @@ void PPU466::draw(glm::uvec2 const &drawable_size) const {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+//All of the programs look up tile pixels using this function:
+// (pasted in to fragment shaders after the #version line)
+static const char *PPUTilePixelFunction =
+	"uniform usampler2D TILE_TABLE;\n"
+	"uniform usampler2D TILE_BITS;\n"
+	"uniform bool PLANAR_TILES;\n"
+	"uint tile_pixel(ivec2 tileCoord) {\n"
+	"	if (PLANAR_TILES) {\n"
+	//decode the bit planes right here; the four 32-bit words of a texel are bit0[0-3], bit0[4-7], bit1[0-3], bit1[4-7]:
+	"		uvec4 tile = texelFetch(TILE_BITS, tileCoord / 8, 0);\n"
+	"		ivec2 px = tileCoord % 8;\n"
+	"		uint shift = uint(8 * (px.y % 4) + px.x);\n"
+	"		uint bit0 = (tile[px.y / 4] >> shift) & 1u;\n"
+	"		uint bit1 = (tile[2 + px.y / 4] >> shift) & 1u;\n"
+	"		return bit0 | (bit1 << 1);\n"
+	"	} else {\n"
+	"		return texelFetch(TILE_TABLE, tileCoord, 0).r;\n"
+	"	}\n"
+	"}\n"
+;
+
+//Both tile programs share a fragment shader:
+static const std::string PPUTileFragmentShader = std::string(
+	"#version 330\n")
+	+ PPUTilePixelFunction +
+	"uniform sampler2D PALETTE_TABLE;\n"
+	"in vec2 tileCoord;\n"
+	"flat in int palette;\n" //"flat" means "uses the value of the provoking [by default, last] vertex in the primitive"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	uint index = tile_pixel(ivec2(tileCoord));\n"
+	"	fragColor = texelFetch(PALETTE_TABLE, ivec2(index, palette), 0);\n"
+	//"	fragColor = vec4(float(index)/4.0,float(palette)/8,1,1);\n"
+	//"	fragColor = texelFetch(TILE_TABLE, ivec2(int(gl_FragCoord.x) % textureSize(TILE_TABLE,0).x, int(gl_FragCoord.y) % textureSize(TILE_TABLE,0).y), 0);\n"
+	//"	fragColor = texelFetch(PALETTE_TABLE, ivec2(int(gl_FragCoord.x) % textureSize(PALETTE_TABLE,0).x, int(gl_FragCoord.y) % textureSize(PALETTE_TABLE,0).y), 0);\n"
+	"}\n"
+;
+
 PPUTileProgram::PPUTileProgram() {
 	program = gl_compile_program(
 		//vertex shader:
@@ -309,19 +737,7 @@ PPUTileProgram::PPUTileProgram() {
 		"}\n"
 	,
 		//fragment shader:
-		"#version 330\n"
-		"uniform usampler2D TILE_TABLE;\n"
-		"uniform sampler2D PALETTE_TABLE;\n"
-		"in vec2 tileCoord;\n"
-		"flat in int palette;\n" //"flat" means "uses the value of the provoking [by default, last] vertex in the primitive"
-		"out vec4 fragColor;\n"
-		"void main() {\n"
-		"	uint index = texelFetch(TILE_TABLE, ivec2(tileCoord), 0).r;\n"
-		"	fragColor = texelFetch(PALETTE_TABLE, ivec2(index, palette), 0);\n"
-		//"	fragColor = vec4(float(index)/4.0,float(palette)/8,1,1);\n"
-		//"	fragColor = texelFetch(TILE_TABLE, ivec2(int(gl_FragCoord.x) % textureSize(TILE_TABLE,0).x, int(gl_FragCoord.y) % textureSize(TILE_TABLE,0).y), 0);\n"
-		//"	fragColor = texelFetch(PALETTE_TABLE, ivec2(int(gl_FragCoord.x) % textureSize(PALETTE_TABLE,0).x, int(gl_FragCoord.y) % textureSize(PALETTE_TABLE,0).y), 0);\n"
-		"}\n"
+		PPUTileFragmentShader
 	);
 
 	//look up the locations of vertex attributes:
@@ -332,13 +748,17 @@ PPUTileProgram::PPUTileProgram() {
 	//look up the locations of uniforms:
 	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
 
+	PLANAR_TILES_bool = glGetUniformLocation(program, "PLANAR_TILES");
+
 	GLuint TILE_TABLE_usampler2D = glGetUniformLocation(program, "TILE_TABLE");
 	GLuint PALETTE_TABLE_sampler2D = glGetUniformLocation(program, "PALETTE_TABLE");
+	GLuint TILE_BITS_usampler2D = glGetUniformLocation(program, "TILE_BITS");
 
 	//bind texture units indices to samplers:
 	glUseProgram(program);
 	glUniform1i(TILE_TABLE_usampler2D, 0);
 	glUniform1i(PALETTE_TABLE_sampler2D, 1);
+	glUniform1i(TILE_BITS_usampler2D, 3);
 	glUseProgram(0);
 
 	GL_ERRORS();
@@ -353,6 +773,134 @@ PPUTileProgram::~PPUTileProgram() {
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+PPUInstancedTileProgram::PPUInstancedTileProgram() {
+	program = gl_compile_program(
+		//vertex shader:
+		"#version 330\n"
+		"uniform mat4 OBJECT_TO_CLIP;\n"
+		"in ivec2 Position;\n"
+		"in uint TileIndex;\n"
+		"in uint Palette;\n"
+		"in uint Flip;\n"
+		"out vec2 tileCoord;\n"
+		"flat out int palette;\n"
+		"void main() {\n"
+		//expand the quad from the vertex index, in the same order as the triangle strip path:
+		// 0 -> (0,0), 1 -> (0,8), 2 -> (8,0), 3 -> (8,8)
+		"	ivec2 corner = 8 * ivec2(gl_VertexID >> 1, gl_VertexID & 1);\n"
+		"	gl_Position = OBJECT_TO_CLIP * vec4(Position + corner, 0.0, 1.0);\n"
+		//flipped tiles read the tile image from the opposite corner (Flip & 0x08 is FlipX, Flip & 0x10 is FlipY):
+		"	ivec2 tileCorner = corner;\n"
+		"	if ((Flip & 0x08u) != 0u) tileCorner.x = 8 - corner.x;\n"
+		"	if ((Flip & 0x10u) != 0u) tileCorner.y = 8 - corner.y;\n"
+		"	tileCoord = 8 * ivec2(TileIndex % 16u, TileIndex / 16u) + tileCorner;\n"
+		"	palette = int(Palette);\n"
+		"}\n"
+	,
+		//fragment shader:
+		PPUTileFragmentShader
+	);
+
+	//look up the locations of vertex attributes:
+	Position_ivec2 = glGetAttribLocation(program, "Position");
+	TileIndex_uint = glGetAttribLocation(program, "TileIndex");
+	Palette_uint = glGetAttribLocation(program, "Palette");
+	Flip_uint = glGetAttribLocation(program, "Flip");
+
+	//look up the locations of uniforms:
+	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
+
+	PLANAR_TILES_bool = glGetUniformLocation(program, "PLANAR_TILES");
+
+	GLuint TILE_TABLE_usampler2D = glGetUniformLocation(program, "TILE_TABLE");
+	GLuint PALETTE_TABLE_sampler2D = glGetUniformLocation(program, "PALETTE_TABLE");
+	GLuint TILE_BITS_usampler2D = glGetUniformLocation(program, "TILE_BITS");
+
+	//bind texture units indices to samplers:
+	glUseProgram(program);
+	glUniform1i(TILE_TABLE_usampler2D, 0);
+	glUniform1i(PALETTE_TABLE_sampler2D, 1);
+	glUniform1i(TILE_BITS_usampler2D, 3);
+	glUseProgram(0);
+
+	GL_ERRORS();
+}
+
+PPUInstancedTileProgram::~PPUInstancedTileProgram() {
+	if (program != 0) {
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+PPUTilemapProgram::PPUTilemapProgram() {
+	program = gl_compile_program(
+		//vertex shader:
+		"#version 330\n"
+		"uniform mat4 OBJECT_TO_CLIP;\n"
+		"out vec2 screenCoord;\n"
+		"void main() {\n"
+		"	vec2 corner = vec2(256.0, 240.0) * vec2(gl_VertexID >> 1, gl_VertexID & 1);\n"
+		"	gl_Position = OBJECT_TO_CLIP * vec4(corner, 0.0, 1.0);\n"
+		"	screenCoord = corner;\n"
+		"}\n"
+	,
+		//fragment shader:
+		std::string("#version 330\n")
+		+ PPUTilePixelFunction +
+		"uniform sampler2D PALETTE_TABLE;\n"
+		"uniform usampler2D BACKGROUND;\n"
+		"uniform ivec2 BACKGROUND_POSITION;\n" //already reduced to [0,512)x[0,480)
+		"in vec2 screenCoord;\n"
+		"out vec4 fragColor;\n"
+		"void main() {\n"
+		//screen pixel -> background pixel, wrapping around the 512x480 background:
+		"	ivec2 px = (ivec2(floor(screenCoord)) - BACKGROUND_POSITION + ivec2(512, 480)) % ivec2(512, 480);\n"
+		"	uint info = texelFetch(BACKGROUND, px / 8, 0).r;\n"
+		"	uint tile = info & 0xffu;\n"
+		"	int palette = int((info >> 8) & 0x7u);\n"
+		//flip bits are bit 11 (FlipX << 8) and bit 12 (FlipY << 8):
+		"	ivec2 inTile = px % 8;\n"
+		"	if ((info & 0x0800u) != 0u) inTile.x = 7 - inTile.x;\n"
+		"	if ((info & 0x1000u) != 0u) inTile.y = 7 - inTile.y;\n"
+		"	ivec2 tileCoord = 8 * ivec2(tile % 16u, tile / 16u) + inTile;\n"
+		"	uint index = tile_pixel(tileCoord);\n"
+		"	fragColor = texelFetch(PALETTE_TABLE, ivec2(index, palette), 0);\n"
+		"}\n"
+	);
+
+	//look up the locations of uniforms:
+	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
+	BACKGROUND_POSITION_ivec2 = glGetUniformLocation(program, "BACKGROUND_POSITION");
+	PLANAR_TILES_bool = glGetUniformLocation(program, "PLANAR_TILES");
+
+	GLuint TILE_TABLE_usampler2D = glGetUniformLocation(program, "TILE_TABLE");
+	GLuint PALETTE_TABLE_sampler2D = glGetUniformLocation(program, "PALETTE_TABLE");
+	GLuint BACKGROUND_usampler2D = glGetUniformLocation(program, "BACKGROUND");
+	GLuint TILE_BITS_usampler2D = glGetUniformLocation(program, "TILE_BITS");
+
+	//bind texture units indices to samplers:
+	glUseProgram(program);
+	glUniform1i(TILE_TABLE_usampler2D, 0);
+	glUniform1i(PALETTE_TABLE_sampler2D, 1);
+	glUniform1i(BACKGROUND_usampler2D, 2);
+	glUniform1i(TILE_BITS_usampler2D, 3);
+	glUseProgram(0);
+
+	GL_ERRORS();
+}
+
+PPUTilemapProgram::~PPUTilemapProgram() {
+	if (program != 0) {
+		glDeleteProgram(program);
+		program = 0;
+	}
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
 
 //PPU data is streamed to the GPU (read: uploaded 'just in time') using a few buffers:
 PPUDataStream::PPUDataStream() {
@@ -364,6 +912,8 @@ PPUDataStream::PPUDataStream() {
 	//vertex_buffer will (eventually) hold vertex data for drawing:
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+	//passing 'nullptr' to BufferData says "allocate memory but don't store anything there":
+	glBufferData(GL_ARRAY_BUFFER, RingSlices * VertexSliceSize, nullptr, GL_STREAM_DRAW);
 
 	//Notice how this binding is attaching an integer input to a floating point attribute:
 	glVertexAttribPointer(
@@ -401,6 +951,35 @@ PPUDataStream::PPUDataStream() {
 	glBindVertexArray(0);
 
 
+	//instance_buffer_for_instanced_tile_program does the same job for instance_buffer:
+	glGenVertexArrays(1, &instance_buffer_for_instanced_tile_program);
+	glBindVertexArray(instance_buffer_for_instanced_tile_program);
+
+	glGenBuffers(1, &instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, RingSlices * InstanceSliceSize, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	point_instance_attributes(0);
+
+	glEnableVertexAttribArray(instanced_tile_program->Position_ivec2);
+	glEnableVertexAttribArray(instanced_tile_program->TileIndex_uint);
+	glEnableVertexAttribArray(instanced_tile_program->Palette_uint);
+	glEnableVertexAttribArray(instanced_tile_program->Flip_uint);
+
+	//a divisor of 1 means "advance once per instance" instead of once per vertex:
+	glVertexAttribDivisor(instanced_tile_program->Position_ivec2, 1);
+	glVertexAttribDivisor(instanced_tile_program->TileIndex_uint, 1);
+	glVertexAttribDivisor(instanced_tile_program->Palette_uint, 1);
+	glVertexAttribDivisor(instanced_tile_program->Flip_uint, 1);
+
+	glBindVertexArray(0);
+
+
+	//core profile won't draw without *some* vertex array object bound:
+	glGenVertexArrays(1, &empty_vertex_array);
+
+
 	glGenTextures(1, &tile_tex);
 	glBindTexture(GL_TEXTURE_2D, tile_tex);
 	//passing 'nullptr' to TexImage says "allocate memory but don't store anything there":
@@ -415,6 +994,44 @@ PPUDataStream::PPUDataStream() {
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 
+	glGenTextures(1, &tile_bits_tex);
+	glBindTexture(GL_TEXTURE_2D, tile_bits_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, 16, 16, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+
+	glGenTextures(1, &background_tex);
+	glBindTexture(GL_TEXTURE_2D, background_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, PPU466::BackgroundWidth, PPU466::BackgroundHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+
+	glGenTextures(1, &screen_tex);
+	glBindTexture(GL_TEXTURE_2D, screen_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PPU466::ScreenWidth, PPU466::ScreenHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &screen_fb);
+	glBindFramebuffer(GL_FRAMEBUFFER, screen_fb);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screen_tex, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		throw std::runtime_error("PPU466 offscreen framebuffer is incomplete.");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+
 	glGenTextures(1, &palette_tex);
 	glBindTexture(GL_TEXTURE_2D, palette_tex);
 	//passing 'nullptr' to TexImage says "allocate memory but don't store anything there":
@@ -429,10 +1046,20 @@ PPUDataStream::PPUDataStream() {
 	glBindTexture(GL_TEXTURE_2D, 0);
 
 
+	//scratch storage gets its final size up front:
+	triangle_strip.reserve(6 * MaxTiles);
+	instances.reserve(MaxTiles);
+
 	GL_ERRORS();
 }
 
 PPUDataStream::~PPUDataStream() {
+	for (auto &fence : slice_fences) {
+		if (fence != 0) {
+			glDeleteSync(fence);
+			fence = 0;
+		}
+	}
 	if (vertex_buffer_for_tile_program != 0) {
 		glDeleteVertexArrays(1, &vertex_buffer_for_tile_program);
 		vertex_buffer_for_tile_program = 0;
@@ -441,6 +1068,14 @@ PPUDataStream::~PPUDataStream() {
 		glDeleteBuffers(1, &vertex_buffer);
 		vertex_buffer = 0;
 	}
+	if (instance_buffer_for_instanced_tile_program != 0) {
+		glDeleteVertexArrays(1, &instance_buffer_for_instanced_tile_program);
+		instance_buffer_for_instanced_tile_program = 0;
+	}
+	if (instance_buffer != 0) {
+		glDeleteBuffers(1, &instance_buffer);
+		instance_buffer = 0;
+	}
 	if (tile_tex != 0) {
 		glDeleteTextures(1, &tile_tex);
 		tile_tex = 0;
@@ -449,4 +1084,100 @@ PPUDataStream::~PPUDataStream() {
 		glDeleteTextures(1, &palette_tex);
 		palette_tex = 0;
 	}
+	if (background_tex != 0) {
+		glDeleteTextures(1, &background_tex);
+		background_tex = 0;
+	}
+	if (tile_bits_tex != 0) {
+		glDeleteTextures(1, &tile_bits_tex);
+		tile_bits_tex = 0;
+	}
+	if (screen_fb != 0) {
+		glDeleteFramebuffers(1, &screen_fb);
+		screen_fb = 0;
+	}
+	if (screen_tex != 0) {
+		glDeleteTextures(1, &screen_tex);
+		screen_tex = 0;
+	}
+	if (empty_vertex_array != 0) {
+		glDeleteVertexArrays(1, &empty_vertex_array);
+		empty_vertex_array = 0;
+	}
+}
+
+uint32_t PPUDataStream::begin_slice() const {
+	uint32_t slice = next_slice;
+	next_slice = (next_slice + 1) % RingSlices;
+
+	if (slice_fences[slice] != 0) {
+		//(with a few frames of slack this should rarely have to wait at all)
+		while (glClientWaitSync(slice_fences[slice], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {
+		}
+		glDeleteSync(slice_fences[slice]);
+		slice_fences[slice] = 0;
+	}
+
+	return slice;
+}
+
+void PPUDataStream::end_slice(uint32_t slice) const {
+	assert(slice < RingSlices);
+	assert(slice_fences[slice] == 0 && "slice was claimed with begin_slice()");
+	slice_fences[slice] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool PPUDataStream::still_presents(PPU466 const &ppu) const {
+	if (!presented.valid || !uploaded.valid) return false;
+	//cheap checks first; then the tables (memcmp is vectorized, so this is a few microseconds at most):
+	return presented.background_color == ppu.background_color
+	    && presented.background_position == ppu.background_position
+	    && std::memcmp(&presented.sprites, &ppu.sprites, sizeof(ppu.sprites)) == 0
+	    && std::memcmp(&uploaded.palette_table, &ppu.palette_table, sizeof(ppu.palette_table)) == 0
+	    && std::memcmp(&uploaded.tile_table, &ppu.tile_table, sizeof(ppu.tile_table)) == 0
+	    && std::memcmp(&presented.background, &ppu.background, sizeof(ppu.background)) == 0;
+}
+
+void PPUDataStream::remember_presented(PPU466 const &ppu) const {
+	presented.valid = (ppu.upscale_path == PPU466::UpscaleBlit);
+	if (!presented.valid) return;
+	presented.background_color = ppu.background_color;
+	presented.background_position = ppu.background_position;
+	presented.background = ppu.background;
+	presented.sprites = ppu.sprites;
+}
+
+void PPUDataStream::point_instance_attributes(size_t offset) const {
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+
+	glVertexAttribIPointer(
+		instanced_tile_program->Position_ivec2, //attribute
+		2, //size
+		GL_SHORT, //type
+		sizeof(Instance), //stride
+		(GLbyte *)0 + offset + offsetof(Instance, Position) //offset
+	);
+	glVertexAttribIPointer(
+		instanced_tile_program->TileIndex_uint, //attribute
+		1, //size
+		GL_UNSIGNED_BYTE, //type
+		sizeof(Instance), //stride
+		(GLbyte *)0 + offset + offsetof(Instance, TileIndex) //offset
+	);
+	glVertexAttribIPointer(
+		instanced_tile_program->Palette_uint, //attribute
+		1, //size
+		GL_UNSIGNED_BYTE, //type
+		sizeof(Instance), //stride
+		(GLbyte *)0 + offset + offsetof(Instance, Palette) //offset
+	);
+	glVertexAttribIPointer(
+		instanced_tile_program->Flip_uint, //attribute
+		1, //size
+		GL_UNSIGNED_BYTE, //type
+		sizeof(Instance), //stride
+		(GLbyte *)0 + offset + offsetof(Instance, Flip) //offset
+	);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
@@ -18,6 +18,81 @@ struct PPU466 {
 	// pass the size of the current framebuffer in pixels so it knows how to scale itself
 	void draw(glm::uvec2 const &drawable_size) const;
 
+	//when you want the PPU's screen without OpenGL (e.g., tests, tools, GPU-less machines), rasterize it on the CPU:
+	// fills pixels[0 .. ScreenWidth*ScreenHeight-1] with the same image draw() produces
+	// rows are stored bottom-to-top, so the result can go straight to save_png(..., LowerLeftOrigin)
+	// 'threads' splits the screen into that many bands of scanlines drawn in parallel
+	void rasterize(glm::u8vec4 *pixels, uint32_t threads = 1) const;
+
+	//Draw Path:
+	// chooses how draw() turns the PPU state into geometry;
+	// both paths produce exactly the same pixels.
+	enum DrawPath : uint8_t {
+		//each tile is expanded on the CPU into a six-vertex triangle strip (the original method):
+		DrawTriangleStrip,
+		//each tile is a single 8-byte instance of a quad that is expanded in the vertex shader:
+		DrawInstanced,
+	};
+	DrawPath draw_path = DrawInstanced;
+
+	//Background Path:
+	// chooses how draw() renders the background layer;
+	// again, both produce exactly the same pixels.
+	enum BackgroundPath : uint8_t {
+		//the visible part of the background is drawn as tiles (using draw_path):
+		BackgroundTiles,
+		//the background is uploaded as a 64x60 texture and resolved per-pixel in one screen-covering pass:
+		// (background cost no longer depends on tile count; only sprites are drawn as tiles)
+		BackgroundTilemap,
+	};
+	BackgroundPath background_path = BackgroundTilemap;
+
+	//Tile Format:
+	// chooses how the tile table gets to the GPU;
+	// also no visible difference, just a different cost.
+	enum TileFormat : uint8_t {
+		//changed tiles are decoded on the CPU into a 128x128 texture with one color index per texel:
+		TilesIndexed,
+		//changed tiles are uploaded as-is (16 bytes each) and decoded in the fragment shader:
+		// (a quarter of the upload and no CPU decode; good when rewriting many tiles every frame)
+		TilesPlanar,
+	};
+	TileFormat tile_format = TilesIndexed;
+
+	//Upscale Path:
+	// chooses how the 256x240 screen gets scaled up to fill the drawable:
+	enum UpscalePath : uint8_t {
+		//tiles are rasterized directly at the scaled-up size:
+		UpscaleDirect,
+		//everything is drawn at 256x240 into an offscreen framebuffer, which is then blitted (nearest-neighbor) to the drawable:
+		// (per-fragment cost stays the same no matter how big the window gets)
+		UpscaleBlit,
+	};
+	UpscalePath upscale_path = UpscaleBlit;
+
+	//Draw Statistics:
+	// draw() reports some counts from the most recent call here
+	// (mutable, since draw() is const)
+	struct DrawStats {
+		//tile table entries and palette table entries that were [re-]uploaded:
+		// (only entries that changed since the previous draw() get uploaded)
+		uint32_t tiles_uploaded = 0;
+		uint32_t palettes_uploaded = 0;
+		//true if the background was [re-]uploaded (only done with BackgroundTilemap, and only when it changed):
+		bool background_uploaded = false;
+
+		//tiles (background tiles and sprites) that were sent to the GPU to be drawn:
+		uint32_t tiles_emitted = 0;
+		//tiles that were skipped because they couldn't affect the image:
+		// (entirely off-screen, or all color 0 with a transparent color 0)
+		uint32_t tiles_culled = 0;
+
+		//true if nothing changed since the previous draw, so its image was shown again as-is:
+		// (only possible with UpscaleBlit, which keeps the previous image around)
+		bool reused_previous_frame = false;
+	};
+	mutable DrawStats draw_stats;
+
 	//--------------------------------------------------------------
 	//Set the values below to control the PPU's drawing:
 
@@ -62,6 +137,14 @@ struct PPU466 {
 	};
 	static_assert(sizeof(Tile) == 16, "Tile is packed");
 
+	//Flip bits:
+	// Sprites and background tiles can be drawn mirrored, so one tile can stand in for its mirror images.
+	// These bits appear in Sprite::attributes and (shifted up by 8) in background values:
+	enum : uint8_t {
+		FlipX = 0x08, //mirror left-to-right: pixel (x,y) of the tile shows at (7-x,y)
+		FlipY = 0x10, //mirror top-to-bottom: pixel (x,y) of the tile shows at (x,7-y)
+	};
+
 	//Tile Table:
 	// The PPU has a 256-tile 'pattern memory' in which tiles are stored:
 	//  this is often thought of as a 16x16 grid of tiles.
@@ -80,13 +163,17 @@ struct PPU466 {
 	//  each value in the grid gives:
 	//    - bits 0-7: tile table index
 	//    - bits 8-10: palette table index
-	//    - bits 11-15: unused, should be 0
+	//    - bit 11: flip the tile horizontally (FlipX << 8)
+	//    - bit 12: flip the tile vertically (FlipY << 8)
+	//    - bits 13-15: unused, should be 0
 	//
 	//  bits:  F E D C B A 9 8 7 6 5 4 3 2 1 0
-	//        |---------|-----|---------------|
-	//            ^        ^        ^-- tile index
-	//            |        '----------- palette index
-	//            '-------------------- unused (set to zero)
+	//        |-----|-|-|-----|---------------|
+	//           ^   ^ ^   ^        ^-- tile index
+	//           |   | |   '----------- palette index
+	//           |   | '--------------- flip horizontally
+	//           |   '----------------- flip vertically
+	//           '--------------------- unused (set to zero)
 	std::array< uint16_t, BackgroundWidth * BackgroundHeight > background;
 
 	//Background Position:
@@ -109,11 +196,14 @@ struct PPU466 {
 	//
 	//  the sprite 'attributes' byte gives:
 	//   bits:  7 6 5 4 3 2 1 0
-	//         |-|-------|-----|
-	//          ^    ^      ^
-	//          |    |      '---- palette index (bits 0-2)
-	//          |    '----------- unused (set to zero)
+	//         |-|---|-|-|-----|
+	//          ^  ^  ^ ^   ^
+	//          |  |  | |   '---- palette index (bits 0-2)
+	//          |  |  | '-------- flip horizontally (bit 3, FlipX)
+	//          |  |  '---------- flip vertically (bit 4, FlipY)
+	//          |  '------------- unused (set to zero)
 	//          '---------------- priority bit (bit 7)
+	//  (the low five bits are laid out like the high byte of a background value)
 	//
 	//  the 'priority bit' chooses whether to render the sprite
 	//   in front of (priority = 0) the background
@@ -0,0 +1,205 @@
+#include "PPU466.hpp"
+#include "decode_tile.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTERIZE_SSE2
+#include <emmintrin.h>
+#endif
+
+//PPU466::rasterize is a CPU implementation of PPU466::draw:
+// it produces the same 256x240 image, but doesn't need (or touch) OpenGL.
+// This makes it useful for tests, tools, and machines without a GPU.
+
+namespace {
+	//every tile of the tile table, decoded (by decode_tile) to one color index per byte:
+	struct DecodedTiles {
+		explicit DecodedTiles(decltype(PPU466::tile_table) const &tile_table) {
+			for (uint32_t i = 0; i < tile_table.size(); ++i) {
+				decode_tile(tile_table[i], indices.data() + 64 * i, 8);
+			}
+		}
+		std::array< uint8_t, 256 * 64 > indices;
+
+		//color indices of row 'y' of tile 'index' as drawn with 'flip' (PPU466::FlipX / FlipY bits), written to out[0-7]:
+		void row(uint8_t index, uint32_t y, uint8_t flip, uint8_t *out) const {
+			if (flip & PPU466::FlipY) y = 7 - y;
+			uint8_t const *row = indices.data() + 64 * index + 8 * y;
+			if (flip & PPU466::FlipX) {
+				for (uint32_t x = 0; x < 8; ++x) {
+					out[x] = row[7 - x];
+				}
+			} else {
+				std::memcpy(out, row, 8);
+			}
+		}
+	};
+
+	//blend 'src' over 'dst' the same way PPU466::draw does:
+	// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) applied to all four channels
+	inline void blend(glm::u8vec4 &dst, glm::u8vec4 const &src) {
+		if (src.a == 0xff) {
+			dst = src;
+		} else if (src.a != 0x00) {
+			uint32_t a = src.a;
+			//(x + 127) / 255 is exactly round(x / 255) for these values:
+			for (uint32_t c = 0; c < 4; ++c) {
+				dst[c] = uint8_t((src[c] * a + dst[c] * (255 - a) + 127) / 255);
+			}
+		}
+	}
+
+	//blend src[0 .. count-1] over dst[0 .. count-1], exactly as blend() would:
+	// (four pixels at a time when SSE2 is available)
+	inline void blend_row(glm::u8vec4 *dst, glm::u8vec4 const *src, uint32_t count) {
+		static_assert(sizeof(glm::u8vec4) == 4, "colors are packed RGBA");
+		uint32_t x = 0;
+	#ifdef RASTERIZE_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alpha_mask = _mm_set1_epi32(int32_t(0xff000000));
+		const __m128i c255 = _mm_set1_epi16(255);
+		const __m128i c127 = _mm_set1_epi16(127);
+		const __m128i one = _mm_set1_epi16(1);
+
+		//blend two pixels, widened to 16 bits per channel:
+		auto blend2 = [&](__m128i s, __m128i d) {
+			//each pixel's alpha in all four of its channels:
+			__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+			//s * a + d * (255 - a) + 127 is at most 65152, so fits in an unsigned 16-bit lane:
+			__m128i v = _mm_add_epi16(
+				_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, _mm_sub_epi16(c255, a))),
+				c127
+			);
+			//v / 255 is exactly (v + 1 + (v >> 8)) >> 8 over that range:
+			return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, one), _mm_srli_epi16(v, 8)), 8);
+		};
+
+		for (; x + 4 <= count; x += 4) {
+			__m128i s = _mm_loadu_si128(reinterpret_cast< __m128i const * >(src + x));
+			//skip all-transparent groups and copy all-opaque ones (by far the most common cases):
+			__m128i alpha = _mm_and_si128(s, alpha_mask);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff) continue;
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) == 0xffff) {
+				_mm_storeu_si128(reinterpret_cast< __m128i * >(dst + x), s);
+				continue;
+			}
+			__m128i d = _mm_loadu_si128(reinterpret_cast< __m128i const * >(dst + x));
+			__m128i lo = blend2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+			__m128i hi = blend2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+			_mm_storeu_si128(reinterpret_cast< __m128i * >(dst + x), _mm_packus_epi16(lo, hi));
+		}
+	#endif
+		for (; x < count; ++x) {
+			blend(dst[x], src[x]);
+		}
+	}
+}
+
+void PPU466::rasterize(glm::u8vec4 *pixels, uint32_t threads) const {
+	assert(pixels);
+
+	constexpr int32_t BackgroundWidthPixels = int32_t(BackgroundWidth) * 8;
+	constexpr int32_t BackgroundHeightPixels = int32_t(BackgroundHeight) * 8;
+
+	//reduce background position to [0,BackgroundWidthPixels) x [0,BackgroundHeightPixels):
+	const glm::ivec2 position = glm::ivec2(
+		((background_position.x % BackgroundWidthPixels) + BackgroundWidthPixels) % BackgroundWidthPixels,
+		((background_position.y % BackgroundHeightPixels) + BackgroundHeightPixels) % BackgroundHeightPixels
+	);
+
+	const glm::u8vec4 clear = glm::u8vec4(background_color, 0xff);
+
+	//every palette color in one table, indexed by palette * 4 + color index:
+	static_assert(std::tuple_size< decltype(palette_table) >::value == 8, "palette indices are 3 bits");
+	std::array< glm::u8vec4, 8 * 4 > colors;
+	for (uint32_t i = 0; i < colors.size(); ++i) {
+		colors[i] = palette_table[i / 4][i % 4];
+	}
+
+	//decode the tile table once, up front, so scanlines only have to look rows up:
+	static_assert(std::tuple_size< decltype(tile_table) >::value == 256, "tile indices are 8 bits");
+	const auto tiles = std::make_unique< DecodedTiles >(tile_table);
+
+	//draw scanlines [begin,end):
+	auto draw_scanlines = [&,this](uint32_t begin, uint32_t end) {
+		//palette * 4 + color index of every pixel of one background row (the whole 512-pixel width),
+		// followed by a copy of its first ScreenWidth pixels, so the screen's span of it is never split by wrapping:
+		uint8_t background_indices[BackgroundWidthPixels + ScreenWidth];
+		//colors of the pixels about to be blended onto the scanline:
+		glm::u8vec4 span[ScreenWidth];
+
+		for (uint32_t y = begin; y < end; ++y) {
+			glm::u8vec4 *row = pixels + ScreenWidth * y;
+
+			//background gets background color:
+			for (uint32_t x = 0; x < ScreenWidth; ++x) {
+				row[x] = clear;
+			}
+
+			//helper to draw the parts of sprites on this scanline:
+			auto draw_sprites = [&,this](uint8_t priority) {
+				for (auto const &sprite : sprites) {
+					if ((sprite.attributes & 0x80) != priority) continue;
+					if (y < sprite.y || y >= uint32_t(sprite.y) + 8) continue;
+					Palette const &palette = palette_table[sprite.attributes & 0x07];
+
+					uint8_t indices[8];
+					tiles->row(sprite.index, y - sprite.y, sprite.attributes & (FlipX | FlipY), indices);
+					for (uint32_t x = 0; x < 8; ++x) {
+						span[x] = palette[indices[x]];
+					}
+					blend_row(row + sprite.x, span, std::min(8U, ScreenWidth - sprite.x));
+				}
+			};
+
+			draw_sprites(0x80); //draw sprites with priority == 1 ('behind' sprites)
+
+			{ //draw the background:
+				//which row of the background lands on this scanline (wrapping around):
+				uint32_t by = uint32_t((int32_t(y) - position.y + BackgroundHeightPixels) % BackgroundHeightPixels);
+				uint16_t const *infos = background.data() + BackgroundWidth * (by / 8);
+				for (uint32_t tx = 0; tx < BackgroundWidth; ++tx) {
+					uint8_t *indices = background_indices + 8 * tx;
+					tiles->row(uint8_t(infos[tx] & 0xff), by % 8, (infos[tx] >> 8) & (FlipX | FlipY), indices);
+					uint8_t palette = uint8_t(((infos[tx] >> 8) & 0x07) << 2);
+					for (uint32_t x = 0; x < 8; ++x) {
+						indices[x] |= palette;
+					}
+				}
+				std::memcpy(background_indices + BackgroundWidthPixels, background_indices, ScreenWidth);
+				//screen pixel x shows background pixel (x - position.x), wrapping around:
+				uint8_t const *visible = background_indices + (BackgroundWidthPixels - position.x) % BackgroundWidthPixels;
+				for (uint32_t x = 0; x < ScreenWidth; ++x) {
+					span[x] = colors[visible[x]];
+				}
+				blend_row(row, span, ScreenWidth);
+			}
+
+			draw_sprites(0x00); //draw sprites with priority == 0 ('in front' sprites)
+		}
+	};
+
+	//split scanlines into bands, one per thread:
+	threads = std::max(1U, std::min(threads, uint32_t(ScreenHeight)));
+	if (threads == 1) {
+		draw_scanlines(0, ScreenHeight);
+		return;
+	}
+
+	std::vector< std::thread > workers;
+	workers.reserve(threads - 1);
+	for (uint32_t t = 1; t < threads; ++t) {
+		workers.emplace_back(draw_scanlines, (ScreenHeight * t) / threads, (ScreenHeight * (t + 1)) / threads);
+	}
+	draw_scanlines(0, ScreenHeight / threads); //this thread does the first band
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
@@ -1,228 +1,38 @@
 #include "PlayMode.hpp"
-#include "load_save_png.hpp"
+#include "Assets.hpp"
 #include "data_path.hpp"
 #include "Load.hpp"
 
+#include <cstring>
 #include <iostream>
-#include <filesystem>
-#include <fstream>
 
-#include <unordered_map>
-#include <set>
 #include <algorithm>
 
 #include <random>
-#include <regex>
 
 
 #define ERROR(msg) std::cerr << "[ERROR] (" << __FILE__ ":" << __LINE__ << ") " << msg << std::endl
 
-std::vector<PPU466::Tile> tiles;
-std::vector<PPU466::Palette> palettes;
-
-struct SpriteData {
-	uint8_t width, height;
-	uint8_t frames;
-	size_t tileStart;
-	std::vector<size_t> paletteIndices;
-};
-std::unordered_map<std::string, SpriteData> spriteData;
-
-struct MapData {
-	uint16_t width;
-	std::vector<uint16_t> tiles;
-};
-std::unordered_map<std::string, MapData> mapData;
-
-Load<void> loadAssets(LoadTagDefault, [](){
-	std::cout << std::endl << "=========== LOADING ASSETS ===========" << std::endl;
-
-	std::string path = data_path("assets");
-
-	//there's prob a better way to this but then again u wouldn't need to if ppu could modified...
-	auto paletteHash = [](const PPU466::Palette& palette) -> size_t {
-		auto colorHash = [](const glm::u8vec4& colors) -> size_t {
-			return std::hash<uint32_t>{}(*reinterpret_cast<const uint32_t*>(&colors));
-		};
-		return colorHash(palette[0]) ^ colorHash(palette[1]) ^ colorHash(palette[2]) ^ colorHash(palette[3]);
-	};
-	auto paletteEqual = [](const PPU466::Palette& a, const PPU466::Palette& b) -> bool {
-		return std::is_permutation(a.begin(), a.end(), b.begin());
-	};
-	std::unordered_map<PPU466::Palette, size_t, decltype(paletteHash), decltype(paletteEqual)> paletteMap(8, paletteHash, paletteEqual);
-
-	//Collect first because of animation frames
-	std::unordered_map<std::string, int8_t> animGroups;
-
-	const std::regex exp("(.*)_(\\d+)\\.png$");
-	for (const auto& itr : std::filesystem::directory_iterator(path + "/sprites")) {
-		if (itr.path().extension() != ".png") continue;
-
-		std::string filename = itr.path().filename().string();
-		std::smatch match;
-
-		if (std::regex_match(filename, match, exp)) {
-			std::string base = match[1].str();
-			if (animGroups.find(base) == animGroups.end()) {
-				animGroups[base] = 0;
-			}
-			animGroups[base] = std::max(animGroups[base], int8_t(std::stoi(match[2].str())));
-		} else {
-			animGroups[itr.path().stem().string()] = 0;
-		}
-	}
-
-	for (const auto& [name, frames] : animGroups) {
-		SpriteData& d = spriteData[name];
-		d.frames = frames + 1;
-		d.tileStart = tiles.size();
-		
-		std::vector<size_t> paletteIndices;
-		for (int8_t i = 0; i <= frames; i++) {
-			std::string framePath = path + "/sprites/" + name + ((frames == 0) ? "" : ("_" + std::to_string(i))) + ".png";
-			std::vector<glm::u8vec4> data;
-			glm::uvec2 size;
-			load_png(framePath, &size, &data, OriginLocation::LowerLeftOrigin);
-
-			if (i == 0) {
-				d.width = uint8_t(size.x / 8);
-				d.height = uint8_t(size.y / 8);
-			}
-			
-			for (size_t ty = 0; ty < size.y / 8; ++ty) {
-				for (size_t tx = 0; tx < size.x / 8; ++tx) {
-					PPU466::Tile tile;
-					PPU466::Palette palette;
-					
-					std::array<glm::u8vec4, 4> colors;
-					size_t count = 0;
-					for (size_t y = 0; y < 8; ++y) {
-						tile.bit0[y] = 0;
-						tile.bit1[y] = 0;
-						for (size_t x = 0; x < 8; ++x) {
-							if ((tx * 8 + x ) >= size.x && (ty * 8 + y) >= size.y) continue;
-							
-							glm::u8vec4 color = data[(ty * 8 + y) * size.x + (tx * 8 + x)];
-							size_t index = 0;
-
-							bool found = false;
-							for (; index < count; ++index) {
-								if (colors[index] == color) {
-									found = true;
-									break;
-								}
-							}
-							if (!found) {
-								if (count < 4) {
-									colors[count] = color;
-									palette[count] = color;
-									count++;
-								} else {
-									ERROR("More than 4 colors in " << framePath);
-									continue;
-								}
-							}
-
-							tile.bit0[y] |= index & 1 ? (1 << x) : 0;
-							tile.bit1[y] |= index & 2 ? (1 << x) : 0;
-						}
-					}
-
-					size_t paletteIndex;
-
-					auto it = paletteMap.find(palette);
-					if (it == paletteMap.end()) {
-						paletteIndex = palettes.size();
-						palettes.push_back(palette);
-						paletteMap[palette] = paletteIndex;
-					} else {
-						paletteIndex = it->second;
-
-						const PPU466::Palette& actualPalette = palettes[paletteIndex];
-						for (size_t y = 0; y < 8; ++y) {
-							tile.bit0[y] = 0;
-							tile.bit1[y] = 0;
-							for (size_t x = 0; x < 8; ++x) {
-								if ((tx * 8 + x ) >= size.x && (ty * 8 + y) >= size.y) continue;
-
-								glm::u8vec4 color = data[(ty * 8 + y) * size.x + (tx * 8 + x)];
-								size_t index = 0;						
-								for (; index < count; ++index) {
-									if (actualPalette[index] == color) break;
-								}
-
-								tile.bit0[y] |= index & 1 ? (1 << x) : 0;
-								tile.bit1[y] |= index & 2 ? (1 << x) : 0;
-							}
-						}
-					}
-					
-					tiles.push_back(tile);
-					paletteIndices.emplace_back(paletteIndex);
-				}
-			}
-		}
-		
-		d.paletteIndices = paletteIndices;
-		
-		std::cout << "Loaded " << name << ": " << (int)d.frames << " frames, " << (tiles.size() - d.tileStart) << " tiles" << std::endl;
-	}
-	std::cout << "Total tiles: " << tiles.size() << std::endl;
-	std::cout << "Total palettes: " << palettes.size() << std::endl;
-
-	for (const auto& itr : std::filesystem::directory_iterator(path + "/levels")) {
-		if (itr.path().extension() != ".csv") continue;
-
-		std::ifstream file(itr.path());
-		if (!file) {
-			throw std::runtime_error("Failed to open .csv file '" + itr.path().string() + "'."); 
-		}
-
-		//excel utf8 bom nonsense
-		char bom[3];
-		file.read(bom, 3);
-		if (bom[0] != '\xEF' || bom[1] != '\xBB' || bom[2] != '\xBF') {
-			file.seekg(0);
-		}
-
-		MapData& map = mapData[itr.path().stem().string()];
-		map.width = 0;
-
-		size_t counter = 0;
-		for (std::string line; std::getline(file, line);) {
-			if (line.empty()) continue;
-
-			std::string value;
-			for (std::stringstream stream(line); std::getline(stream, value, ',');) {
-				value.erase(0, value.find_first_not_of(" \t\n\r"));
-				value.erase(value.find_last_not_of(" \t\n\r") + 1);
-
-				auto it = spriteData.find(value);
-				if (it == spriteData.end()) {
-					ERROR("Tile not found: " << value);
-					map.tiles.push_back(0);
-					continue;
-				}
-
-				uint8_t tile = it->second.tileStart & 0xFF;
-				uint8_t palette = it->second.paletteIndices[0] & 0x07;
-				map.tiles.push_back(tile | (palette << 8)); //FIXME
-
-				counter++;
-			}
+Load<AssetPack> assets(LoadTagDefault, []() -> AssetPack const * {
+	//assets are imported at build time by bake-assets (see Maekfile.js):
+	AssetPack *ret = new AssetPack(data_path("assets.pack"));
+	std::cout << "Mapped assets.pack: " << ret->tiles.size() << " tiles, " << ret->palettes.size() << " palettes, "
+		<< ret->spriteData.size() << " sprites, " << ret->mapInfos.size() << " levels" << std::endl;
+	return ret;
+});
 
-			if (map.width == 0) {
-				map.width = uint16_t(counter);
-			}
-		}
+//background value for cells with nothing to show (see BlankTileSlot in level_residency.hpp):
+constexpr uint16_t BlankCell = uint16_t(BlankTileSlot | (BlankPaletteSlot << 8));
 
-		std::cout << "Loaded " << itr.path().filename() << ": " << map.width << " wide" << std::endl;
-	}
+PlayMode::PlayMode() :
+	//(slots from BlankTileSlot / BlankPaletteSlot on are never handed out)
+	tileSlots(BlankTileSlot, uint32_t(assets->tiles.size())),
+	paletteSlots(BlankPaletteSlot, uint32_t(assets->palettes.size())) {
+	std::memset(&ppu.tile_table[BlankTileSlot], 0, sizeof(ppu.tile_table[BlankTileSlot]));
+	ppu.palette_table[BlankPaletteSlot].fill(glm::u8vec4(0x00, 0x00, 0x00, 0x00));
+	backgroundColumns.fill(-1);
+	backgroundRetry.fill(false);
 
-	std::cout << "=========== FINISHED LOADING ASSETS ===========" << std::endl;
-});
-
-PlayMode::PlayMode() {
 	player.LoadSprites("player");
 	player.x = 100;
 	player.y = 100;
@@ -302,7 +112,13 @@ void PlayMode::update(float elapsed) {
 		camera.x = int32_t(player.x) - camera.rightThreshold;
 	}
 	camera.x = std::max(0, camera.x);
-	camera.x = std::min(camera.x, std::max(0, int32_t(background.width * 8) - 256));
+	int32_t levelWidth = background.level ? int32_t(background.level->width) : 0;
+	camera.x = std::min(camera.x, std::max(0, levelWidth * 8 - 256));
+
+	//stream in the level around the camera (a page to either side, so it's loaded before it's on screen):
+	if (background.level) {
+		background.level->want(camera.x / 8 - int32_t(AssetPack::LevelPageColumns), camera.x / 8 + int32_t(PPU466::BackgroundWidth + AssetPack::LevelPageColumns));
+	}
 
 	//reset button press counters:
 	left.downs = 0;
@@ -312,42 +128,11 @@ void PlayMode::update(float elapsed) {
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
-	//this is all quite retarded i'm realizing now...
-	std::set<size_t> usedTiles, usedPalettes; //FIXME: use vector instead
-	
-	for (Entity* entity : entities) {
-		for (const Sprite& sprite : entity->sprites) {
-			usedTiles.insert(sprite.tileIndices[sprite.frame]);
-			usedPalettes.insert(sprite.paletteIndices[sprite.frame]);
-		}
-	}	
-	for (const uint16_t& tile : background.tiles) {
-		usedTiles.insert(tile & 0xFF);
-		usedPalettes.insert((tile >> 8) & 0x07);
-	}
-	
-	std::unordered_map<size_t, size_t> tileMap, paletteMap;
-	
-	//FIXME: add sorting pass for z order
-	size_t index = 0;
-	for (size_t globalIndex : usedTiles) {
-		ppu.tile_table[index] = tiles[globalIndex];
-		tileMap[globalIndex] = index;
-		index++;
-	}
-	index = 0;
-	for (size_t globalIndex : usedPalettes) {
-		if (index >= 8 ) {
-			ERROR("too many palettes");
-			return;
-		}
-		ppu.palette_table[index] = palettes[globalIndex];
-		paletteMap[globalIndex] = index;
-		index++;
-	}
-		
+	uint32_t overflowsBefore = tileSlots.overflows + paletteSlots.overflows;
+
 	//Sprites
-	index = 0;
+	static_assert(std::tuple_size<decltype(ppu.sprites)>::value == std::tuple_size<decltype(shownSprites)>::value, "one Shown per sprite");
+	size_t index = 0;
 	for (Entity* entity : entities) {
 		for (Sprite& sprite : entity->sprites) {
 			//FIXME: background flashing prob dude to something...
@@ -362,58 +147,142 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 			int32_t screenX = int32_t(entity->x) + sprite.offset.x - camera.x;
 			int32_t screenY = int32_t(entity->y) + sprite.offset.y;
 
-			if (screenX >= -8 && screenX < 256) {
-				ppu.sprites[index].x = uint8_t(screenX);
-				ppu.sprites[index].y = uint8_t(screenY);
-				ppu.sprites[index].index = uint8_t(tileMap[sprite.tileIndices[sprite.frame]]);
-				ppu.sprites[index].attributes = uint8_t(paletteMap[sprite.paletteIndices[sprite.frame]]);
-				
+			if (screenX >= -8 && screenX < 256 && index < ppu.sprites.size()) {
+				Shown& shown = shownSprites[index];
+				if (Show(shown, uint32_t(sprite.tileIndices[sprite.frame]), uint32_t(sprite.paletteIndices[sprite.frame]))) {
+					ppu.sprites[index].x = uint8_t(screenX);
+					ppu.sprites[index].y = uint8_t(screenY);
+					ppu.sprites[index].index = uint8_t(shown.tileSlot);
+					ppu.sprites[index].attributes = uint8_t(shown.paletteSlot | sprite.flips[sprite.frame]);
+				} else {
+					ppu.sprites[index].y = 255; //(no room; reported below)
+				}
 				index++;
 			}
 		}
 	}
 	for (size_t i = index; i < ppu.sprites.size(); ++i) {
+		Show(shownSprites[i], Shown::None, Shown::None);
 		ppu.sprites[i].y = 255; //FIXME: should prob hide under background in case of big sprites maybe?
 	}
-	
+
 	//Background
-	for (uint32_t y = 0; y < 30; ++y) {
-		for (uint32_t x = 0; x < PPU466::BackgroundWidth; ++x) {
-			uint32_t worldX = camera.x / 8 + x;
-
-			uint16_t tile = 0;
-			if (worldX < background.width) {
-				uint32_t tileIndex = (29 - y) * background.width + worldX;
-				if (tileIndex < background.tiles.size()) {
-					tile = background.tiles[tileIndex];
-
-					auto tileItr = tileMap.find(tile & 0xFF);
-					auto palItr = paletteMap.find((tile >> 8) & 0x07);
-					if (tileItr != tileMap.end() && palItr != paletteMap.end()) {
-						tile = uint16_t(tileItr->second | (palItr->second << 8));
-					}
-				}
+	// only columns that just came into view are filled in (and cells that didn't fit last time retried)
+	// (which columns are on screen is the same as what bake-assets checked fits; see level_residency.hpp)
+	constexpr int32_t ScreenColumns = int32_t(LevelScreenColumns);
+	int32_t firstColumn = camera.x / 8;
+	for (uint32_t x = 0; x < PPU466::BackgroundWidth; ++x) {
+		int32_t column = backgroundColumns[x];
+		if (column != -1 && (column < firstColumn || column >= firstColumn + ScreenColumns)) {
+			ClearBackgroundColumn(x);
+		}
+	}
+	std::shared_ptr<LevelStream::Page const> page;
+	for (int32_t column = firstColumn; column < firstColumn + ScreenColumns; ++column) {
+		uint32_t x = uint32_t(column) % PPU466::BackgroundWidth;
+		if (backgroundColumns[x] == column && !backgroundRetry[x]) continue;
+		backgroundColumns[x] = column;
+		backgroundRetry[x] = false;
+
+		uint16_t const *tiles = nullptr; //from the top; null past the end of the level
+		uint32_t rows = 0;
+		if (background.level && uint32_t(column) < background.level->width) {
+			if (!page || uint32_t(column) >= page->column + page->columns) page = background.level->page(uint32_t(column));
+			tiles = page->tiles(uint32_t(column));
+			rows = background.level->height;
+		}
+
+		for (uint32_t y = 0; y < 30; ++y) {
+			uint32_t row = 29 - y;
+			uint32_t cell = x + PPU466::BackgroundWidth * y;
+			if (!tiles || row >= rows) {
+				Show(shownBackground[cell], Shown::None, Shown::None);
+				ppu.background[cell] = BlankCell;
+				continue;
+			}
+			uint16_t tile = tiles[row];
+			Shown& shown = shownBackground[cell];
+			if (Show(shown, tile & 0xFF, (tile >> 8) & 0x07)) {
+				ppu.background[cell] = uint16_t(shown.tileSlot | ((shown.paletteSlot | ((tile >> 8) & (PPU466::FlipX | PPU466::FlipY))) << 8));
+			} else {
+				ppu.background[cell] = BlankCell;
+				backgroundRetry[x] = true;
 			}
-			ppu.background[x + PPU466::BackgroundWidth * y] = tile;
 		}
 	}
-	
-	ppu.background_position.x = -(camera.x % 8);
+
+	ppu.background_position.x = -camera.x; //(wraps around, same as the columns)
 	ppu.background_position.y = 0;
 
+	//report running out of slots when it starts (rather than every frame it lasts):
+	bool overflowing = (tileSlots.overflows + paletteSlots.overflows != overflowsBefore);
+	if (overflowing && !overflowed) {
+		ERROR("Out of tile or palette slots; some sprites or background tiles are not drawn ("
+			<< tileSlots.referenced() << " tiles and " << paletteSlots.referenced() << " palettes in use).");
+	}
+	overflowed = overflowing;
+
 	ppu.draw(drawable_size);
 }
 
+bool PlayMode::Show(Shown& shown, uint32_t tile, uint32_t palette) {
+	if (shown.tile == tile && shown.palette == palette) return true;
+
+	tileSlots.release(shown.tileSlot);
+	paletteSlots.release(shown.paletteSlot);
+	shown = Shown();
+	if (tile == Shown::None) return true;
+	if (tile >= assets->tiles.size() || palette >= assets->palettes.size()) {
+		ERROR("Tile " << tile << " / palette " << palette << " isn't in the asset pack.");
+		return false;
+	}
+
+	bool load = false;
+	uint32_t tileSlot = tileSlots.acquire(tile, &load);
+	if (load) ppu.tile_table[tileSlot] = assets->tiles[tile];
+	uint32_t paletteSlot = paletteSlots.acquire(palette, &load);
+	if (load) ppu.palette_table[paletteSlot] = assets->palettes[palette];
+
+	if (tileSlot == SlotResidency::NoSlot || paletteSlot == SlotResidency::NoSlot) {
+		tileSlots.release(tileSlot);
+		paletteSlots.release(paletteSlot);
+		return false;
+	}
+	shown.tile = tile;
+	shown.palette = palette;
+	shown.tileSlot = tileSlot;
+	shown.paletteSlot = paletteSlot;
+	return true;
+}
+
+void PlayMode::ClearBackgroundColumn(uint32_t x) {
+	for (uint32_t y = 0; y < PPU466::BackgroundHeight; ++y) {
+		uint32_t cell = x + PPU466::BackgroundWidth * y;
+		Show(shownBackground[cell], Shown::None, Shown::None);
+		ppu.background[cell] = BlankCell;
+	}
+	backgroundColumns[x] = -1;
+	backgroundRetry[x] = false;
+}
+
 
 void PlayMode::StartLevel(const std::string& levelname) {
-	auto itr = mapData.find(levelname);
-	if (itr == mapData.end()) {
-		ERROR("Level not found: " << levelname);
+	for (uint32_t x = 0; x < PPU466::BackgroundWidth; ++x) {
+		ClearBackgroundColumn(x);
+	}
+
+	try {
+		background.level = std::make_unique<LevelStream>(*assets, levelname);
+	} catch (std::exception const &e) {
+		ERROR("Level not found: " << levelname << " (" << e.what() << ")");
 		return;
 	}
+	//(nothing is loaded yet -- update asks for the pages around the camera, so starting doesn't depend on the level's size)
 
-	background.width = itr->second.width;
-	background.tiles = itr->second.tiles;	
+	//bake-assets already checked the background always fits, along with any of the pack's sprites:
+	const AssetPack::MapInfo& info = assets->mapInfos.at(levelname);
+	std::cout << "Started " << levelname << ": background and sprites need at most " << info.peakTiles << " of " << BlankTileSlot << " tile slots and "
+		<< int(info.peakPalettes) << " of " << BlankPaletteSlot << " palette slots" << std::endl;
 }
 
 Entity::Entity(const std::string& assetName) {
@@ -421,8 +290,8 @@ Entity::Entity(const std::string& assetName) {
 }
 
 void Entity::LoadSprites(const std::string& assetName) {
-	auto it = spriteData.find(assetName);
-	if (it == spriteData.end()) {
+	auto it = assets->spriteData.find(assetName);
+	if (it == assets->spriteData.end()) {
 		ERROR("Asset not found: " << assetName);
 		return;
 	}
@@ -436,8 +305,9 @@ void Entity::LoadSprites(const std::string& assetName) {
 		sprite.offset = data.width > 0 ? glm::i8vec2(i % data.width * 8, i / data.width * 8) : glm::i8vec2(0, 0);
 
 		for (uint8_t frame = 0; frame < data.frames; frame++) {
-			sprite.tileIndices.emplace_back(data.tileStart + (frame * data.width * data.height) + i);
+			sprite.tileIndices.emplace_back(data.tileIndices[frame * data.width * data.height + i]);
 			sprite.paletteIndices.emplace_back(data.paletteIndices[frame * data.width * data.height + i]);
+			sprite.flips.emplace_back(data.tileFlips[frame * data.width * data.height + i]);
 		}
 		sprites.emplace_back(sprite);
 	}
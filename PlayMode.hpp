@@ -1,8 +1,12 @@
 #include "PPU466.hpp"
 #include "Mode.hpp"
+#include "level_stream.hpp"
+#include "slot_residency.hpp"
 
 #include <glm/glm.hpp>
 
+#include <array>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,6 +16,7 @@ struct Sprite {
 	size_t actualFrames = 0;
 	std::vector<size_t> tileIndices;
 	std::vector<size_t> paletteIndices;
+	std::vector<uint8_t> flips; //PPU466::FlipX / FlipY, per frame
 	glm::i8vec2 offset;
 };
 
@@ -31,8 +36,7 @@ struct Player : Entity {
 };
 
 struct Background {
-	uint16_t width;
-	std::vector<uint16_t> tiles;
+	std::unique_ptr<LevelStream> level; //streamed from the asset pack a page at a time; null if no level is loaded
 };
 
 struct Camera {
@@ -68,4 +72,33 @@ struct PlayMode : Mode {
 	//----- drawing handled by PPU466 -----
 
 	PPU466 ppu;
+
+	//which of the asset pack's tiles / palettes are in which slots of ppu.tile_table / ppu.palette_table:
+	// (kept from frame to frame, so only tiles and palettes that come into view get loaded)
+	// (the last slot of each table is kept blank instead; see BlankTileSlot in level_residency.hpp)
+	SlotResidency tileSlots, paletteSlots;
+
+	//the asset pack tile and palette a background cell or sprite shows, and the slots it holds for them:
+	struct Shown {
+		static constexpr uint32_t None = ~0u;
+		uint32_t tile = None, palette = None;
+		uint32_t tileSlot = SlotResidency::NoSlot, paletteSlot = SlotResidency::NoSlot;
+	};
+	std::array<Shown, PPU466::BackgroundWidth * PPU466::BackgroundHeight> shownBackground;
+	std::array<Shown, 64> shownSprites;
+
+	//level column drawn in each column of ppu.background, or -1 for none:
+	// (the background is used as a ring -- level column c goes in column c % BackgroundWidth --
+	//  so scrolling only has to fill in the columns that come into view)
+	std::array<int32_t, PPU466::BackgroundWidth> backgroundColumns;
+	//columns that some cells didn't fit in (out of slots), so they're filled in again next frame:
+	// (they keep their level column, so the cells that did fit are still released when they scroll off)
+	std::array<bool, PPU466::BackgroundWidth> backgroundRetry;
+
+	bool overflowed = false; //did the last frame run out of slots? (so it's only reported when it starts)
+
+	//point 'shown' at a tile and palette (or at nothing, with Shown::None), loading them into slots if needed:
+	// returns false (and shows nothing) if there's no room
+	bool Show(Shown& shown, uint32_t tile, uint32_t palette);
+	void ClearBackgroundColumn(uint32_t x);
 };
\ No newline at end of file
@@ -0,0 +1,134 @@
+//asset-pack-test loads a baked asset pack, then damages each of its chunks in turn and checks the damage is caught:
+// usage: asset-pack-test <pack> <scratch file>
+// (run by Maekfile.js as part of the ':test' target; the damaged copies are written to -- then removed from -- <scratch file>)
+
+#include "Assets.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+	//everything an AssetPack can be asked to read: (constructing it reads all but the level pages)
+	void read_everything(std::string const &filename, bool verify_checksums) {
+		AssetPack pack(filename, verify_checksums);
+		std::vector< uint16_t > tiles;
+		for (auto const &[name, info] : pack.mapInfos) {
+			for (uint32_t page = 0; page < info.pages(); ++page) {
+				if (!pack.read_map_page(name, page, &tiles)) {
+					throw std::runtime_error("Level '" + name + "' is missing page " + std::to_string(page) + ".");
+				}
+			}
+		}
+	}
+
+	void write_file(std::string const &filename, std::vector< char > const &data) {
+		std::ofstream out(filename, std::ios::binary);
+		out.write(data.data(), data.size());
+		if (!out) throw std::runtime_error("Failed to write '" + filename + "'.");
+	}
+
+	struct Damage {
+		std::string name;
+		bool verify_checksums;
+		//damage the chunk with table of contents entry 'entry' in 'data':
+		std::function< void(std::vector< char > &data, ChunkTOC::Entry const &entry) > apply;
+	};
+
+	std::vector< Damage > const damages = {
+		//claim more data than the chunk has (it's followed by other chunks, so this stays inside the file):
+		{"header size +32", true, [](std::vector< char > &data, ChunkTOC::Entry const &entry) {
+			uint32_t size;
+			std::memcpy(&size, data.data() + entry.offset + 4, 4);
+			size += 32;
+			std::memcpy(data.data() + entry.offset + 4, &size, 4);
+		}},
+		{"header magic", true, [](std::vector< char > &data, ChunkTOC::Entry const &entry) {
+			data[entry.offset] ^= 0x20;
+		}},
+		{"data byte", true, [](std::vector< char > &data, ChunkTOC::Entry const &entry) {
+			if (entry.size != 0) data[entry.offset + 8 + entry.size / 2] ^= 0x01;
+			else data[entry.offset + 4] ^= 0x01; //(no data to damage; damage the size instead)
+		}},
+		//even without checksums, a bad header size must not let a chunk's reader run on into the next chunk:
+		{"header size +32, unverified", false, [](std::vector< char > &data, ChunkTOC::Entry const &entry) {
+			uint32_t size;
+			std::memcpy(&size, data.data() + entry.offset + 4, 4);
+			size += 32;
+			std::memcpy(data.data() + entry.offset + 4, &size, 4);
+		}},
+	};
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <pack> <scratch file>" << std::endl;
+		return 1;
+	}
+	std::string pack_file = argv[1];
+	std::string scratch_file = argv[2];
+
+	std::vector< char > original;
+	{
+		std::ifstream in(pack_file, std::ios::binary);
+		original.assign(std::istreambuf_iterator< char >(in), std::istreambuf_iterator< char >());
+		if (!in.eof() && !in) {
+			std::cerr << "FAILED: couldn't read '" << pack_file << "'." << std::endl;
+			return 1;
+		}
+	}
+
+	//the undamaged pack has to load:
+	ChunkTOC toc;
+	try {
+		read_everything(pack_file, true);
+		if (!read_toc(std::span< char const >(original), &toc)) {
+			throw std::runtime_error("Pack has no table of contents.");
+		}
+	} catch (std::exception &e) {
+		std::cerr << "FAILED: '" << pack_file << "' doesn't load: " << e.what() << std::endl;
+		return 1;
+	}
+
+	uint32_t failures = 0;
+	uint32_t checks = 0;
+	for (Damage const &damage : damages) {
+		for (ChunkTOC::Entry const &entry : toc.entries) {
+			std::vector< char > data = original;
+			damage.apply(data, entry);
+			try {
+				write_file(scratch_file, data);
+			} catch (std::exception &e) {
+				std::cerr << "FAILED: " << e.what() << std::endl;
+				return 1;
+			}
+
+			checks += 1;
+			std::string what;
+			try {
+				read_everything(scratch_file, damage.verify_checksums);
+			} catch (std::exception &e) {
+				what = e.what();
+			}
+			if (what.empty()) {
+				std::cerr << "FAILED: pack loaded with damaged chunk '" << std::string(entry.magic, 4) << "' '" << toc.name(entry)
+					<< "' (" << damage.name << ")." << std::endl;
+				failures += 1;
+			}
+		}
+	}
+	std::remove(scratch_file.c_str());
+
+	if (failures != 0) {
+		std::cerr << failures << " of " << checks << " damaged packs loaded anyway." << std::endl;
+		return 1;
+	}
+	std::cout << "All " << checks << " damaged copies of '" << pack_file << "' (" << toc.entries.size() << " chunks) failed to load." << std::endl;
+	return 0;
+}
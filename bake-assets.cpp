@@ -0,0 +1,32 @@
+//bake-assets imports sprite PNGs and level CSVs and writes them as a single pack for the game to load:
+// usage: bake-assets <assets dir> <output pack>
+// (run by Maekfile.js whenever anything in the assets directory changes)
+
+#include "Assets.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <assets dir> <output pack>" << std::endl;
+		return 1;
+	}
+
+	try {
+		Assets assets;
+		import_assets(argv[1], &assets);
+
+		std::ofstream out(argv[2], std::ios::binary);
+		write_assets_pack(assets, &out);
+		if (!out) {
+			throw std::runtime_error("Failed to write '" + std::string(argv[2]) + "'.");
+		}
+	} catch (std::exception &e) {
+		std::cerr << "Failed to bake assets: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#define CRC32C_SSE42_TARGET __attribute__((target("sse4.2")))
+#elif defined(_M_X64)
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#include <intrin.h>
+#define CRC32C_SSE42_TARGET
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM
+#include <arm_acle.h>
+#endif
+
+//tables[k][b] is the crc of byte b followed by k zero bytes:
+static constexpr std::array< std::array< uint32_t, 256 >, 8 > tables = [](){
+	std::array< std::array< uint32_t, 256 >, 8 > ret{};
+	for (uint32_t b = 0; b < 256; ++b) {
+		uint32_t crc = b;
+		for (uint32_t i = 0; i < 8; ++i) {
+			crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1u))); //reversed Castagnoli polynomial
+		}
+		ret[0][b] = crc;
+	}
+	for (uint32_t k = 1; k < 8; ++k) {
+		for (uint32_t b = 0; b < 256; ++b) {
+			ret[k][b] = (ret[k-1][b] >> 8) ^ ret[0][ret[k-1][b] & 0xff];
+		}
+	}
+	return ret;
+}();
+
+uint32_t crc32c_table(void const *data_, size_t size, uint32_t crc) {
+	uint8_t const *data = reinterpret_cast< uint8_t const * >(data_);
+	crc = ~crc;
+	//eight bytes at a time:
+	for (; size >= 8; data += 8, size -= 8) {
+		uint32_t lo, hi;
+		std::memcpy(&lo, data, 4);
+		std::memcpy(&hi, data + 4, 4);
+		lo ^= crc; //(NOTE: assumes little-endian, as does the rest of the chunk format)
+		crc = tables[7][lo & 0xff] ^ tables[6][(lo >> 8) & 0xff] ^ tables[5][(lo >> 16) & 0xff] ^ tables[4][lo >> 24]
+		    ^ tables[3][hi & 0xff] ^ tables[2][(hi >> 8) & 0xff] ^ tables[1][(hi >> 16) & 0xff] ^ tables[0][hi >> 24];
+	}
+	for (; size > 0; ++data, --size) {
+		crc = (crc >> 8) ^ tables[0][(crc ^ *data) & 0xff];
+	}
+	return ~crc;
+}
+
+#if defined(CRC32C_SSE42)
+
+CRC32C_SSE42_TARGET
+static uint32_t crc32c_sse42(uint8_t const *data, size_t size, uint32_t crc) {
+	crc = ~crc;
+	#if defined(__x86_64__) || defined(_M_X64)
+	uint64_t crc64 = crc;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = uint32_t(crc64);
+	#endif
+	for (; size >= 4; data += 4, size -= 4) {
+		uint32_t word;
+		std::memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	for (; size > 0; ++data, --size) {
+		crc = _mm_crc32_u8(crc, *data);
+	}
+	return ~crc;
+}
+
+static bool have_sse42() {
+	#if defined(_M_X64)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 20)) != 0;
+	#else
+	return __builtin_cpu_supports("sse4.2");
+	#endif
+}
+
+uint32_t crc32c(void const *data, size_t size, uint32_t crc) {
+	static const bool sse42 = have_sse42();
+	if (sse42) return crc32c_sse42(reinterpret_cast< uint8_t const * >(data), size, crc);
+	else return crc32c_table(data, size, crc);
+}
+
+#elif defined(CRC32C_ARM)
+
+uint32_t crc32c(void const *data_, size_t size, uint32_t crc) {
+	uint8_t const *data = reinterpret_cast< uint8_t const * >(data_);
+	crc = ~crc;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint64_t word;
+		std::memcpy(&word, data, 8);
+		crc = __crc32cd(crc, word);
+	}
+	for (; size > 0; ++data, --size) {
+		crc = __crc32cb(crc, *data);
+	}
+	return ~crc;
+}
+
+#else
+
+uint32_t crc32c(void const *data, size_t size, uint32_t crc) {
+	return crc32c_table(data, size, crc);
+}
+
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * CRC-32C (Castagnoli) checksums, used to check chunk data for corruption (see read_write_chunk.hpp).
+ *
+ * Uses the SSE4.2 (x86) or CRC (ARM) crc32c instructions when the CPU has them,
+ *  and otherwise a slicing-by-8 table method; all give the same results.
+ */
+
+//checksum of 'size' bytes at 'data', continuing from 'crc' (the checksum of the bytes before):
+// (crc32c("123456789", 9) == 0xe3069283)
+uint32_t crc32c(void const *data, size_t size, uint32_t crc = 0);
+
+//table-only version; this is the reference crc32c must always agree with:
+uint32_t crc32c_table(void const *data, size_t size, uint32_t crc = 0);
@@ -0,0 +1,85 @@
+//decode-tile-test checks decode_tile against decode_tile_scalar and times them both:
+// usage: decode-tile-test
+// (run by Maekfile.js as part of the ':test' target)
+
+#include "decode_tile.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+int main(int argc, char **argv) {
+	if (argc != 1) {
+		std::cerr << "Usage:\n\t" << argv[0] << std::endl;
+		return 1;
+	}
+
+	//---- equivalence ----
+	//every (bit0, bit1) row combination, in every row of a tile, at a few strides and alignments:
+	// (tile c has combination (c + y) % 65536 in row y, so each combination lands in each row once)
+	uint32_t mismatches = 0;
+	for (size_t stride : {size_t(8), size_t(13), size_t(128)}) {
+		for (size_t offset : {size_t(0), size_t(3)}) {
+			std::vector< uint8_t > expected(offset + stride * 7 + 8, 0xee);
+			std::vector< uint8_t > got(expected.size(), 0xee);
+			for (uint32_t c = 0; c < 0x10000; ++c) {
+				PPU466::Tile tile;
+				for (uint32_t y = 0; y < 8; ++y) {
+					uint32_t combination = (c + y) & 0xffff;
+					tile.bit0[y] = uint8_t(combination);
+					tile.bit1[y] = uint8_t(combination >> 8);
+				}
+				decode_tile_scalar(tile, expected.data() + offset, stride);
+				decode_tile(tile, got.data() + offset, stride);
+				//(compares the bytes between rows too, so writing outside the tile counts as a mismatch)
+				if (std::memcmp(expected.data(), got.data(), expected.size()) != 0) {
+					if (mismatches < 10) {
+						std::cerr << "Mismatch for tile " << c << " (stride " << stride << ", offset " << offset << ")." << std::endl;
+					}
+					mismatches += 1;
+				}
+			}
+		}
+	}
+	if (mismatches != 0) {
+		std::cerr << "FAILED: decode_tile disagrees with decode_tile_scalar on " << mismatches << " tiles." << std::endl;
+		return 1;
+	}
+	std::cout << "decode_tile matches decode_tile_scalar for all 65536 row combinations." << std::endl;
+
+	//---- benchmark ----
+	//decode a whole 256-tile table into a 128x128 texture, the way PPU466::draw does:
+	std::array< PPU466::Tile, 256 > tiles;
+	uint32_t seed = 1;
+	for (auto &tile : tiles) {
+		for (uint32_t y = 0; y < 8; ++y) {
+			seed = seed * 1664525u + 1013904223u;
+			tile.bit0[y] = uint8_t(seed >> 16);
+			tile.bit1[y] = uint8_t(seed >> 24);
+		}
+	}
+	std::vector< uint8_t > texture(128 * 128);
+
+	auto time = [&](char const *name, void (*decode)(PPU466::Tile const &, uint8_t *, size_t)) {
+		constexpr uint32_t Tables = 2000;
+		uint32_t sum = 0;
+		auto before = std::chrono::high_resolution_clock::now();
+		for (uint32_t t = 0; t < Tables; ++t) {
+			for (uint32_t i = 0; i < tiles.size(); ++i) {
+				decode(tiles[i], texture.data() + (i % 16) * 8 + (i / 16) * 8 * 128, 128);
+			}
+			sum += texture[t % texture.size()]; //(so the decodes can't be skipped)
+		}
+		auto after = std::chrono::high_resolution_clock::now();
+		double ns = std::chrono::duration< double, std::nano >(after - before).count();
+		std::cout << "  " << name << ": " << ns / (double(Tables) * tiles.size()) << " ns/tile, "
+			<< ns / Tables / 1000.0 << " us/table (checksum " << sum << ")" << std::endl;
+	};
+	std::cout << "Decoding a 256-tile table:" << std::endl;
+	time("decode_tile_scalar", decode_tile_scalar);
+	time("decode_tile", decode_tile);
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "decode_tile.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DECODE_TILE_SSE2
+#include <emmintrin.h>
+#endif
+
+void decode_tile_scalar(PPU466::Tile const &tile, uint8_t *out, size_t stride) {
+	for (uint32_t y = 0; y < 8; ++y) {
+		for (uint32_t x = 0; x < 8; ++x) {
+			out[x + stride * y] =
+				  ((tile.bit0[y] >> x) & 1)
+				| ((tile.bit1[y] >> x) & 1) << 1;
+		}
+	}
+}
+
+#ifdef DECODE_TILE_SSE2
+
+void decode_tile(PPU466::Tile const &tile, uint8_t *out, size_t stride) {
+	//lane i tests bit (i % 8) of its row byte:
+	const __m128i bit = _mm_set_epi8(-128,64,32,16,8,4,2,1, -128,64,32,16,8,4,2,1);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+
+	//replicate each row byte of a bit plane eight times, giving four vectors of two rows each:
+	auto spread = [](uint8_t const *plane, __m128i rows[4]) {
+		__m128i bytes = _mm_loadl_epi64(reinterpret_cast< __m128i const * >(plane)); //r0 r1 ... r7
+		bytes = _mm_unpacklo_epi8(bytes, bytes); //r0 r0 r1 r1 ... r7 r7
+		__m128i lo = _mm_unpacklo_epi16(bytes, bytes); //r0 x4 ... r3 x4
+		__m128i hi = _mm_unpackhi_epi16(bytes, bytes); //r4 x4 ... r7 x4
+		rows[0] = _mm_unpacklo_epi32(lo, lo); //r0 x8, r1 x8
+		rows[1] = _mm_unpackhi_epi32(lo, lo); //r2 x8, r3 x8
+		rows[2] = _mm_unpacklo_epi32(hi, hi); //r4 x8, r5 x8
+		rows[3] = _mm_unpackhi_epi32(hi, hi); //r6 x8, r7 x8
+	};
+
+	__m128i rows0[4], rows1[4];
+	spread(tile.bit0.data(), rows0);
+	spread(tile.bit1.data(), rows1);
+
+	for (uint32_t i = 0; i < 4; ++i) {
+		//0xff in every lane whose bit is set:
+		__m128i set0 = _mm_cmpeq_epi8(_mm_and_si128(rows0[i], bit), bit);
+		__m128i set1 = _mm_cmpeq_epi8(_mm_and_si128(rows1[i], bit), bit);
+		__m128i index = _mm_or_si128(_mm_and_si128(set0, one), _mm_and_si128(set1, two));
+
+		_mm_storel_epi64(reinterpret_cast< __m128i * >(out + stride * (2 * i + 0)), index);
+		_mm_storel_epi64(reinterpret_cast< __m128i * >(out + stride * (2 * i + 1)), _mm_unpackhi_epi64(index, index));
+	}
+}
+
+#else //no SSE2
+
+void decode_tile(PPU466::Tile const &tile, uint8_t *out, size_t stride) {
+	decode_tile_scalar(tile, out, stride);
+}
+
+#endif
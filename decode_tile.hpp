@@ -0,0 +1,21 @@
+#pragma once
+
+#include "PPU466.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Expand a PPU466::Tile's two bit planes into one color index (0-3) per byte.
+ *
+ * Writes eight rows of eight bytes, bottom row first (same order as Tile::bit0/bit1),
+ *  with the start of each row 'stride' bytes after the start of the previous one.
+ *
+ * Useful anywhere tiles need to become pixels: texture uploads, importers, software rendering.
+ */
+
+//decodes 16 pixels at a time when SSE2 is available, otherwise falls back to decode_tile_scalar:
+void decode_tile(PPU466::Tile const &tile, uint8_t *out, size_t stride);
+
+//one pixel at a time; this is the reference decode_tile must always agree with:
+void decode_tile_scalar(PPU466::Tile const &tile, uint8_t *out, size_t stride);
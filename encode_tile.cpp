@@ -0,0 +1,94 @@
+#include "encode_tile.hpp"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ENCODE_TILE_SSE2
+#include <emmintrin.h>
+#endif
+
+EncodedTile encode_tile_scalar(glm::u8vec4 const *pixels, size_t stride) {
+	EncodedTile ret;
+	ret.palette.fill(glm::u8vec4(0));
+	for (uint32_t y = 0; y < 8; ++y) {
+		ret.tile.bit0[y] = 0;
+		ret.tile.bit1[y] = 0;
+		for (uint32_t x = 0; x < 8; ++x) {
+			glm::u8vec4 color = pixels[x + stride * y];
+			uint32_t index = 0;
+			while (index < ret.colors && ret.palette[index] != color) ++index;
+			if (index == ret.colors) {
+				if (ret.colors < 4) {
+					ret.palette[ret.colors++] = color;
+				} else {
+					if (ret.extra_pixels++ == 0) ret.first_extra = glm::u8vec2(x, y);
+					continue;
+				}
+			}
+			ret.tile.bit0[y] |= (index & 1) << x;
+			ret.tile.bit1[y] |= ((index >> 1) & 1) << x;
+		}
+	}
+	return ret;
+}
+
+#ifdef ENCODE_TILE_SSE2
+
+EncodedTile encode_tile(glm::u8vec4 const *pixels, size_t stride) {
+	static_assert(sizeof(glm::u8vec4) == 4, "colors are 32-bit words");
+
+	EncodedTile ret;
+	ret.palette.fill(glm::u8vec4(0));
+
+	//each palette color, repeated in all four lanes:
+	__m128i colors[4];
+
+	for (uint32_t y = 0; y < 8; ++y) {
+		__m128i lo = _mm_loadu_si128(reinterpret_cast< __m128i const * >(pixels + stride * y)); //pixels 0-3
+		__m128i hi = _mm_loadu_si128(reinterpret_cast< __m128i const * >(pixels + stride * y + 4)); //pixels 4-7
+
+		//bit x set if pixel x is the color:
+		auto match = [&](__m128i color) -> uint32_t {
+			uint32_t lo_bits = uint32_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lo, color))));
+			uint32_t hi_bits = uint32_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(hi, color))));
+			return lo_bits | (hi_bits << 4);
+		};
+
+		uint32_t masks[4] = {0, 0, 0, 0};
+		uint32_t unmatched = 0xff;
+		for (uint32_t i = 0; i < ret.colors; ++i) {
+			masks[i] = match(colors[i]);
+			unmatched &= ~masks[i];
+		}
+		//new colors, leftmost first (so entries are assigned in the same order as the scalar version):
+		while (unmatched && ret.colors < 4) {
+			uint32_t x = 0;
+			while (!(unmatched & (1u << x))) ++x;
+			uint32_t color;
+			std::memcpy(&color, pixels + stride * y + x, 4);
+			ret.palette[ret.colors] = pixels[stride * y + x];
+			colors[ret.colors] = _mm_set1_epi32(int32_t(color));
+			masks[ret.colors] = match(colors[ret.colors]) & unmatched;
+			unmatched &= ~masks[ret.colors];
+			++ret.colors;
+		}
+		if (unmatched) {
+			uint32_t x = 0;
+			while (!(unmatched & (1u << x))) ++x;
+			if (ret.extra_pixels == 0) ret.first_extra = glm::u8vec2(x, y);
+			for (uint32_t bits = unmatched; bits; bits &= bits - 1) ++ret.extra_pixels;
+		}
+
+		ret.tile.bit0[y] = uint8_t(masks[1] | masks[3]);
+		ret.tile.bit1[y] = uint8_t(masks[2] | masks[3]);
+	}
+	return ret;
+}
+
+#else //no SSE2
+
+EncodedTile encode_tile(glm::u8vec4 const *pixels, size_t stride) {
+	return encode_tile_scalar(pixels, stride);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "PPU466.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Quantize an 8x8 block of RGBA pixels into a PPU466::Tile and the Palette it uses.
+ * (the inverse of decode_tile)
+ *
+ * Reads eight rows of eight pixels, bottom row first (same order as Tile::bit0/bit1),
+ *  with the start of each row 'stride' pixels after the start of the previous one.
+ *
+ * Palette entries are assigned in order of first appearance (bottom row first, left to right);
+ *  unused entries are left as (0,0,0,0).
+ */
+
+struct EncodedTile {
+	PPU466::Tile tile;
+	PPU466::Palette palette;
+	uint8_t colors = 0; //number of palette entries used
+
+	//pixels whose color didn't fit in the four palette entries (these get color index 0):
+	uint8_t extra_pixels = 0;
+	//position of the first such pixel, if any:
+	glm::u8vec2 first_extra = glm::u8vec2(0);
+};
+
+//compares a whole row (eight pixels) against each palette color at once when SSE2 is available, otherwise falls back to encode_tile_scalar:
+EncodedTile encode_tile(glm::u8vec4 const *pixels, size_t stride);
+
+//one pixel at a time; this is the reference encode_tile must always agree with:
+EncodedTile encode_tile_scalar(glm::u8vec4 const *pixels, size_t stride);
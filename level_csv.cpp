@@ -0,0 +1,108 @@
+#include "level_csv.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEVEL_CSV_SSE2
+#include <emmintrin.h>
+#endif
+
+#define ERROR(msg) std::cerr << "[ERROR] (" << __FILE__ ":" << __LINE__ << ") " << msg << std::endl
+
+//call f(position) for every ',', '\n', and '\r' in [begin,end), in order:
+// (cells are usually only a few bytes long, so each 16-byte block's delimiters come out of one bit mask)
+template< typename F >
+static void for_each_delimiter(char const *begin, char const *end, F const &f) {
+	char const *at = begin;
+#ifdef LEVEL_CSV_SSE2
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i carriage_return = _mm_set1_epi8('\r');
+	for (; end - at >= 16; at += 16) {
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast< __m128i const * >(at));
+		__m128i hits = _mm_or_si128(
+			_mm_cmpeq_epi8(bytes, comma),
+			_mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, carriage_return))
+		);
+		for (uint32_t mask = uint32_t(_mm_movemask_epi8(hits)); mask; mask &= mask - 1) {
+			f(at + std::countr_zero(mask));
+		}
+	}
+#endif
+	for (; at != end; ++at) {
+		if (*at == ',' || *at == '\n' || *at == '\r') f(at);
+	}
+}
+
+void parse_level_csv(std::span< char const > csv, LevelCells const &cells, std::string const &filename, MapData *map) {
+	assert(map);
+	map->width = 0;
+	map->tiles.clear();
+
+	char const *begin = csv.data();
+	char const *end = csv.data() + csv.size();
+
+	//excel utf8 bom nonsense
+	if (end - begin >= 3 && begin[0] == '\xEF' && begin[1] == '\xBB' && begin[2] == '\xBF') {
+		begin += 3;
+	}
+
+	size_t line = 1; //(for error messages)
+	size_t row_cells = 0; //cells so far in the current row
+
+	auto trim = [](char const *b, char const *e) {
+		while (b != e && (*b == ' ' || *b == '\t')) ++b;
+		while (e != b && (e[-1] == ' ' || e[-1] == '\t')) --e;
+		return std::string_view(b, size_t(e - b));
+	};
+
+	auto end_cell = [&](std::string_view name) {
+		auto it = cells.find(name);
+		if (it == cells.end()) {
+			ERROR("Tile not found: '" << name << "' (" << filename << ":" << line << ")");
+			map->tiles.push_back(0);
+		} else {
+			map->tiles.push_back(it->second);
+		}
+		++row_cells;
+	};
+
+	auto end_row = [&](char const *rest) {
+		if (row_cells == 0) return; //blank line
+		if (map->width == 0) {
+			if (row_cells > 0xffff) {
+				throw std::runtime_error(filename + ":" + std::to_string(line) + ": row has " + std::to_string(row_cells) + " cells; levels can be at most 65535 wide.");
+			}
+			map->width = uint16_t(row_cells);
+			//every row is this wide, so the rest of the level (one row per line, near enough) fits in:
+			size_t rows = 1 + size_t(std::count(rest, end, '\n'));
+			map->tiles.reserve(map->tiles.size() + rows * map->width);
+		} else if (row_cells != map->width) {
+			throw std::runtime_error(filename + ":" + std::to_string(line) + ": row has " + std::to_string(row_cells) + " cells, but the first row has " + std::to_string(map->width) + ".");
+		}
+		row_cells = 0;
+	};
+
+	char const *cell_begin = begin;
+	for_each_delimiter(begin, end, [&](char const *at) {
+		std::string_view name = trim(cell_begin, at);
+		if (*at == ',') {
+			end_cell(name);
+		} else {
+			//(an empty last cell isn't a cell -- a trailing comma doesn't add one -- so blank lines stay blank too)
+			if (!name.empty()) end_cell(name);
+			end_row(at + 1);
+			//lines end with "\n", "\r\n", or a lone "\r":
+			if (*at == '\n' || at + 1 == end || at[1] != '\n') ++line;
+		}
+		cell_begin = at + 1;
+	});
+
+	//last line, if it didn't end with a newline:
+	std::string_view name = trim(cell_begin, end);
+	if (!name.empty()) end_cell(name);
+	end_row(end);
+}
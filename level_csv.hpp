@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Assets.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/*
+ * Parse a level CSV: one row of the level per line, each cell the name of the sprite whose tile goes there.
+ *
+ * Levels can be tens of thousands of columns wide, so this works directly on the file's bytes
+ *  (e.g., a MappedFile): delimiters are found 16 bytes at a time when SSE2 is available,
+ *  names are looked up as string_views, and tiles are written straight into MapData::tiles.
+ */
+
+//cell name -> background tile (in PPU466::background format) to put there:
+// (built once per import; the string_views usually point at the keys of Assets::spriteData,
+//  so looking a cell up doesn't need to copy its name)
+using LevelCells = std::unordered_map< std::string_view, uint16_t >;
+
+//parse 'csv' (the whole file) into map->width and map->tiles, rows in file order:
+// - a UTF-8 byte order mark at the start is skipped (spreadsheet programs like to add one)
+// - lines may end with "\n", "\r\n", or "\r"; blank lines are skipped
+// - spaces and tabs around names are ignored
+// - a trailing comma at the end of a row doesn't add a cell
+// - unknown names are reported (with 'filename' and line number) and get tile 0
+//NOTE: throws if a row has a different number of cells than the first, or more than 65535 cells
+void parse_level_csv(std::span< char const > csv, LevelCells const &cells, std::string const &filename, MapData *map);
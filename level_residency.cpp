@@ -0,0 +1,78 @@
+#include "level_residency.hpp"
+#include "Assets.hpp"
+
+#include <algorithm>
+
+LevelResidency plan_level_residency(MapData const &map, SpriteResidency const &sprites) {
+	LevelResidency plan;
+	if (map.width == 0) return plan;
+	uint32_t height = uint32_t(map.tiles.size() / map.width);
+
+	//how many cells in the window use each tile / palette:
+	// (cells hold global indices, so these cover the first 256 tiles and 8 palettes -- or all of them, if there are more)
+	std::vector< uint32_t > tileCounts(std::max< size_t >(256, sprites.tiles.size()), 0);
+	std::vector< uint32_t > paletteCounts(std::max< size_t >(8, sprites.palettes.size()), 0);
+	uint32_t tiles = 0, palettes = 0;
+	//sprites' tiles / palettes that aren't in the window (so would need slots of their own):
+	uint32_t spriteTiles = uint32_t(std::count(sprites.tiles.begin(), sprites.tiles.end(), true));
+	uint32_t spritePalettes = uint32_t(std::count(sprites.palettes.begin(), sprites.palettes.end(), true));
+
+	auto isSprite = [](std::vector< bool > const &marked, uint32_t index) {
+		return index < marked.size() && marked[index];
+	};
+
+	//add (+1) or remove (-1) a column, returning how many tiles it brought into the window:
+	auto update = [&](uint32_t column, int32_t change) {
+		uint32_t added = 0;
+		for (uint32_t row = 0; row < height; ++row) {
+			uint16_t cell = map.tiles[row * map.width + column];
+			uint32_t tile = cell & 0xFF;
+			uint32_t palette = (cell >> 8) & 0x07;
+			if (change > 0) {
+				if (tileCounts[tile]++ == 0) {
+					++tiles;
+					++added;
+					if (isSprite(sprites.tiles, tile)) --spriteTiles;
+				}
+				if (paletteCounts[palette]++ == 0) {
+					++palettes;
+					if (isSprite(sprites.palettes, palette)) --spritePalettes;
+				}
+			} else {
+				if (--tileCounts[tile] == 0) {
+					--tiles;
+					if (isSprite(sprites.tiles, tile)) ++spriteTiles;
+				}
+				if (--paletteCounts[palette] == 0) {
+					--palettes;
+					if (isSprite(sprites.palettes, palette)) ++spritePalettes;
+				}
+			}
+		}
+		return added;
+	};
+
+	uint32_t window = std::min< uint32_t >(LevelScreenColumns, map.width);
+	for (uint32_t column = 0; column < map.width; ++column) {
+		uint32_t added = update(column, +1);
+		if (column >= window) {
+			update(column - window, -1);
+			plan.peakTileLoads = std::max(plan.peakTileLoads, added);
+		}
+		if (column + 1 >= window) {
+			uint32_t first = column + 1 - window;
+			//(each sprite shows one tile with one palette, so sprites can't add more than there are sprites)
+			uint32_t needTiles = tiles + std::min(spriteTiles, sprites.sprites);
+			uint32_t needPalettes = palettes + std::min(spritePalettes, sprites.sprites);
+			if (needTiles > plan.peakTiles) {
+				plan.peakTiles = needTiles;
+				plan.peakTilesColumn = first;
+			}
+			if (needPalettes > plan.peakPalettes) {
+				plan.peakPalettes = needPalettes;
+				plan.peakPalettesColumn = first;
+			}
+		}
+	}
+	return plan;
+}
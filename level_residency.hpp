@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PPU466.hpp"
+
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+struct MapData; //from Assets.hpp
+
+/*
+ * Residency plans -- which tiles and palettes a level's background needs in PPU466's tables as the camera moves.
+ *
+ * PlayMode keeps the level columns on screen resident (LevelScreenColumns of them), so a level only
+ *  draws correctly if every run of that many columns -- along with whatever sprites are drawn over it --
+ *  fits in the tile and palette tables.
+ * Levels never change, so bake-assets works this out ahead of time, fails the build if a level doesn't fit,
+ *  and records the worst case in the pack.
+ */
+
+//level columns on screen at once: a screen's worth, plus the one scrolled partway in:
+constexpr uint32_t LevelScreenColumns = PPU466::ScreenWidth / 8 + 1;
+
+//PlayMode never hands out the last tile slot or the last palette slot:
+// they hold a blank tile and a fully transparent palette, for background cells with nothing to show
+// (so levels and sprites get the slots below these)
+constexpr uint32_t BlankTileSlot = uint32_t(std::tuple_size< decltype(PPU466::tile_table) >::value) - 1;
+constexpr uint32_t BlankPaletteSlot = uint32_t(std::tuple_size< decltype(PPU466::palette_table) >::value) - 1;
+
+//the tiles and palettes sprites might add to what the background needs:
+// (any of the marked ones -- indices into Assets::tiles / palettes -- but no more than one each per PPU sprite)
+struct SpriteResidency {
+	std::vector< bool > tiles, palettes;
+	uint32_t sprites = uint32_t(std::tuple_size< decltype(PPU466::sprites) >::value);
+};
+
+struct LevelResidency {
+	//most tiles / palettes needed at once -- distinct ones in the window, plus sprites' that aren't --
+	// and the first column of the first window that needs that many:
+	uint32_t peakTiles = 0, peakTilesColumn = 0;
+	uint32_t peakPalettes = 0, peakPalettesColumn = 0;
+	//most tiles that come into view when the camera scrolls by one column:
+	// (an upper bound on slot loads per column; tiles that only just scrolled off may still be resident)
+	uint32_t peakTileLoads = 0;
+};
+
+//slide a LevelScreenColumns-wide window over the level, counting the tiles and palettes in it and what sprites could add:
+LevelResidency plan_level_residency(MapData const &map, SpriteResidency const &sprites);
@@ -0,0 +1,148 @@
+#include "level_stream.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+LevelStream::Page::Page(uint32_t column_, uint32_t columns_, uint32_t height_, std::vector< uint16_t > const &rows) : column(column_), columns(columns_), height(height_) {
+	assert(rows.size() == size_t(columns) * height);
+	column_indices.reserve(columns);
+	std::vector< uint16_t > tiles(height);
+	for (uint32_t x = 0; x < columns; ++x) {
+		for (uint32_t row = 0; row < height; ++row) {
+			tiles[row] = rows[row * columns + x];
+		}
+		//(a page has only a few dozen columns, so a linear search is plenty)
+		uint32_t index = 0;
+		uint32_t count = height ? uint32_t(distinct.size() / height) : 0;
+		while (index < count && std::memcmp(distinct.data() + size_t(index) * height, tiles.data(), height * sizeof(uint16_t)) != 0) ++index;
+		if (index == count) {
+			distinct.insert(distinct.end(), tiles.begin(), tiles.end());
+		}
+		column_indices.emplace_back(uint16_t(index));
+	}
+	distinct.shrink_to_fit();
+}
+
+LevelStream::LevelStream(AssetPack const &pack_, std::string const &name_, uint32_t max_pages_) : pack(pack_), name(name_), max_pages(std::max(1U, max_pages_)) {
+	auto it = pack.mapInfos.find(name);
+	if (it == pack.mapInfos.end()) {
+		throw std::runtime_error("Asset pack has no level '" + name + "'.");
+	}
+	width = it->second.width;
+	height = it->second.height;
+
+	loader = std::thread(&LevelStream::load_pages, this);
+}
+
+LevelStream::~LevelStream() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	requested.notify_all();
+	loader.join();
+}
+
+void LevelStream::want(int32_t begin, int32_t end) {
+	begin = std::max(begin, 0);
+	end = std::min(end, int32_t(width));
+	if (begin >= end) return;
+
+	uint32_t first = uint32_t(begin) / AssetPack::LevelPageColumns;
+	uint32_t last = uint32_t(end - 1) / AssetPack::LevelPageColumns;
+	assert(last - first < max_pages && "wanting more pages than can be kept");
+
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		for (uint32_t index = first; index <= last; ++index) {
+			touch(index, false);
+		}
+	}
+	requested.notify_all();
+}
+
+std::shared_ptr< LevelStream::Page const > LevelStream::page(uint32_t x) {
+	assert(x < width);
+	uint32_t index = x / AssetPack::LevelPageColumns;
+
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		if (error) std::rethrow_exception(error);
+		touch(index, true);
+		auto const &slot = slots.at(index);
+		if (slot.page) return slot.page;
+		requested.notify_all();
+		loaded.wait(lock);
+	}
+}
+
+void LevelStream::touch(uint32_t index, bool urgent) {
+	auto [slot, inserted] = slots.emplace(index, Slot());
+	slot->second.last_wanted = ++tick;
+	if (inserted) {
+		//(pages being waited on jump the line; the rest load in the order they were wanted)
+		if (urgent) queue.push_front(index);
+		else queue.push_back(index);
+	} else if (urgent && !slot->second.page) {
+		auto queued = std::find(queue.begin(), queue.end(), index);
+		if (queued != queue.end()) {
+			queue.erase(queued);
+			queue.push_front(index);
+		}
+	}
+}
+
+void LevelStream::evict() {
+	while (true) {
+		size_t count = 0;
+		auto oldest = slots.end();
+		for (auto it = slots.begin(); it != slots.end(); ++it) {
+			if (!it->second.page) continue;
+			++count;
+			if (oldest == slots.end() || it->second.last_wanted < oldest->second.last_wanted) oldest = it;
+		}
+		if (count <= max_pages) return;
+		slots.erase(oldest);
+	}
+}
+
+void LevelStream::load_pages() {
+	std::unique_lock< std::mutex > lock(mutex);
+	while (true) {
+		requested.wait(lock, [this]() { return quit || !queue.empty(); });
+		if (quit) return;
+
+		uint32_t index = queue.front();
+		queue.pop_front();
+
+		//read without holding the lock, so the game can keep drawing the pages it has:
+		lock.unlock();
+		std::shared_ptr< Page const > page;
+		std::exception_ptr failed;
+		try {
+			std::vector< uint16_t > rows;
+			if (!pack.read_map_page(name, index, &rows)) {
+				throw std::runtime_error("Asset pack has no page " + std::to_string(index) + " of level '" + name + "'.");
+			}
+			uint32_t column = index * AssetPack::LevelPageColumns;
+			page = std::make_shared< Page const >(column, std::min< uint32_t >(AssetPack::LevelPageColumns, width - column), height, rows);
+		} catch (...) {
+			failed = std::current_exception();
+		}
+		lock.lock();
+
+		if (failed) {
+			error = failed;
+			slots.erase(index);
+		} else {
+			auto slot = slots.find(index);
+			if (slot != slots.end()) { //(otherwise, nobody wants it any more)
+				slot->second.page = page;
+				evict();
+			}
+		}
+		loaded.notify_all();
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Assets.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * LevelStream -- a level from an AssetPack, loaded a page (AssetPack::LevelPageColumns columns) at a time.
+ *
+ * Pages are read (and decompressed) by a background thread: the game says which columns it will need
+ *  soon with 'want', and only waits in 'page' if one of them hasn't arrived by the time it's drawn.
+ * At most 'max_pages' pages are kept; the one wanted least recently is dropped first, so memory use
+ *  and level start time don't depend on how big the level is.
+ */
+
+struct LevelStream {
+	//NOTE: throws if 'pack' has no level called 'name'
+	// (pack must outlive the stream)
+	LevelStream(AssetPack const &pack, std::string const &name, uint32_t max_pages = 8);
+	~LevelStream();
+
+	LevelStream(LevelStream const &) = delete;
+	LevelStream &operator=(LevelStream const &) = delete;
+
+	uint16_t width = 0, height = 0;
+
+	//columns [column, column + columns) of the level, stored as a dictionary of distinct columns:
+	// levels are mostly the same few columns of sky and ground over and over, so this is usually
+	// several times smaller than storing every tile, and a whole column is still just a lookup away
+	struct Page {
+		//build from the page's tiles as stored in the pack (row by row from the top):
+		Page(uint32_t column, uint32_t columns, uint32_t height, std::vector< uint16_t > const &rows);
+
+		uint32_t column = 0, columns = 0;
+		uint32_t height = 0;
+		std::vector< uint16_t > distinct; //distinct columns, 'height' tiles each (from the top)
+		std::vector< uint16_t > column_indices; //which distinct column each of the page's columns is
+
+		//the 'height' tiles (from the top) of level column x, which must be in the page:
+		uint16_t const *tiles(uint32_t x) const { return distinct.data() + size_t(column_indices[x - column]) * height; }
+		//tile at level column x (which must be in the page) and row 'row' (from the top):
+		uint16_t at(uint32_t x, uint32_t row) const { return tiles(x)[row]; }
+	};
+
+	//start loading the pages that hold columns [begin, end) (clipped to the level), if they aren't loaded already:
+	// returns immediately; the range should span fewer than max_pages pages
+	void want(int32_t begin, int32_t end);
+
+	//the page holding column 'x' (which must be < width), waiting for it to load if needed:
+	// the page stays valid while the pointer is held, even if the stream drops it
+	//NOTE: rethrows any error from reading the page
+	std::shared_ptr< Page const > page(uint32_t x);
+
+private:
+	AssetPack const &pack;
+	std::string name;
+	uint32_t max_pages;
+
+	//everything below is shared with the loading thread, so is guarded by 'mutex':
+	std::mutex mutex;
+	std::condition_variable requested; //signalled when 'queue' grows or 'quit' is set
+	std::condition_variable loaded; //signalled when a page finishes loading
+
+	struct Slot {
+		std::shared_ptr< Page const > page; //null while loading
+		uint64_t last_wanted = 0;
+	};
+	std::unordered_map< uint32_t, Slot > slots; //loaded and loading pages, by index
+	std::deque< uint32_t > queue; //pages to load, in order
+	uint64_t tick = 0; //counts calls to want / page, for last_wanted
+	std::exception_ptr error; //from the loading thread
+	bool quit = false;
+
+	//mark 'index' as just wanted, queueing it if it isn't loaded or loading (call with mutex held):
+	void touch(uint32_t index, bool urgent);
+	//drop least-recently-wanted loaded pages until there are no more than max_pages (call with mutex held):
+	void evict();
+
+	std::thread loader;
+	void load_pages();
+};
@@ -0,0 +1,133 @@
+#include "lz_block.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+	constexpr size_t MinMatch = 4;
+	constexpr size_t MaxOffset = 65535;
+	constexpr uint32_t HashBits = 12;
+
+	uint32_t read32(char const *at) {
+		uint32_t ret;
+		std::memcpy(&ret, at, 4);
+		return ret;
+	}
+
+	uint32_t hash4(char const *at) {
+		return (read32(at) * 2654435761u) >> (32 - HashBits);
+	}
+
+	void put_length(size_t length, std::vector< char > *out) {
+		while (length >= 255) {
+			out->emplace_back(char(255));
+			length -= 255;
+		}
+		out->emplace_back(char(length));
+	}
+}
+
+void lz_compress_block(char const *src, size_t src_size, std::vector< char > *out_) {
+	auto &out = *out_;
+
+	//most recent position of each hashed four-byte string (+1; 0 means none):
+	std::vector< uint32_t > recent(size_t(1) << HashBits, 0);
+
+	size_t literal_begin = 0;
+	auto emit = [&](size_t literal_end, size_t match_offset, size_t match_length) {
+		size_t literals = literal_end - literal_begin;
+		size_t extra = (match_length ? match_length - MinMatch : 0);
+		out.emplace_back(char(
+			  (std::min< size_t >(literals, 15) << 4)
+			| (match_length ? std::min< size_t >(extra, 15) : 0)
+		));
+		if (literals >= 15) put_length(literals - 15, &out);
+		out.insert(out.end(), src + literal_begin, src + literal_end);
+		if (match_length) {
+			out.emplace_back(char(match_offset & 0xff));
+			out.emplace_back(char(match_offset >> 8));
+			if (extra >= 15) put_length(extra - 15, &out);
+		}
+	};
+
+	size_t at = 0;
+	while (src_size >= MinMatch && at + MinMatch <= src_size) {
+		uint32_t h = hash4(src + at);
+		size_t candidate = recent[h];
+		recent[h] = uint32_t(at + 1);
+		if (candidate != 0 && at - (candidate - 1) <= MaxOffset && read32(src + candidate - 1) == read32(src + at)) {
+			candidate -= 1;
+			size_t length = MinMatch;
+			while (at + length < src_size && src[candidate + length] == src[at + length]) ++length;
+			emit(at, at - candidate, length);
+			//remember a few positions inside the match so later repeats can find them:
+			for (size_t i = at + 1; i < at + length && i + MinMatch <= src_size; i += 2) {
+				recent[hash4(src + i)] = uint32_t(i + 1);
+			}
+			at += length;
+			literal_begin = at;
+		} else {
+			++at;
+		}
+	}
+	//final sequence is all literals:
+	emit(src_size, 0, 0);
+}
+
+void lz_decompress_block(char const *src, size_t src_size, char *dst, size_t dst_size) {
+	char const *in = src;
+	char const *in_end = src + src_size;
+	char *op = dst;
+	char *op_end = dst + dst_size;
+
+	auto get_length = [&](size_t length) {
+		if (length != 15) return length;
+		while (true) {
+			if (in == in_end) throw std::runtime_error("Compressed data is truncated.");
+			uint8_t more = uint8_t(*in++);
+			length += more;
+			if (more != 255) return length;
+		}
+	};
+
+	while (true) {
+		if (in == in_end) throw std::runtime_error("Compressed data is truncated.");
+		uint8_t token = uint8_t(*in++);
+
+		size_t literals = get_length(token >> 4);
+		if (size_t(in_end - in) < literals || size_t(op_end - op) < literals) {
+			throw std::runtime_error("Compressed data has out-of-range literals.");
+		}
+		if (literals) std::memcpy(op, in, literals);
+		in += literals;
+		op += literals;
+
+		if (in == in_end) break; //final sequence has no match
+
+		if (in_end - in < 2) throw std::runtime_error("Compressed data is truncated.");
+		size_t offset = size_t(uint8_t(in[0])) | (size_t(uint8_t(in[1])) << 8);
+		in += 2;
+		size_t length = get_length(token & 0xf) + MinMatch;
+		if (offset == 0 || offset > size_t(op - dst) || size_t(op_end - op) < length) {
+			throw std::runtime_error("Compressed data has out-of-range match.");
+		}
+
+		char const *match = op - offset;
+		if (offset >= length) {
+			std::memcpy(op, match, length);
+			op += length;
+		} else {
+			//overlapping match (e.g., a run of one repeated value) repeats the last 'offset' bytes;
+			// each copy doubles the length of the repeated pattern behind op, so copy in growing pieces:
+			for (char *end = op + length; op != end; ) {
+				size_t piece = std::min(size_t(op - match), size_t(end - op));
+				std::memcpy(op, match, piece);
+				op += piece;
+			}
+		}
+	}
+
+	if (op != op_end) throw std::runtime_error("Compressed data decodes to the wrong size.");
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * A small LZ77-style byte compressor (in the spirit of LZ4), built for fast decoding.
+ *
+ * Compressed data is a series of sequences, each:
+ *  |token| <-- high nibble: literal count, low nibble: match length - 4 (15 => more length bytes follow)
+ *  |lit..| <-- literal count bytes copied as-is
+ *  |of|fs| <-- match offset (1-65535 bytes back, little endian); omitted in the final sequence
+ *  (each length of 15+ continues with bytes that are added on until a byte is not 255)
+ *
+ * Used by the compressed chunk functions in read_write_chunk.hpp.
+ */
+
+//compressed data never decodes to more than this many bytes per byte:
+// (a sequence's token + offset yield at most 19 bytes of match, and each length byte after that at most 255 more)
+constexpr size_t LzMaxExpansion = 255;
+
+//append compressed 'src' to *out:
+void lz_compress_block(char const *src, size_t src_size, std::vector< char > *out);
+
+//decompress 'src' to exactly 'dst_size' bytes at 'dst':
+//NOTE: throws on malformed data or data that decodes to the wrong size (never writes outside dst)
+void lz_decompress_block(char const *src, size_t src_size, char *dst, size_t dst_size);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+/*
+ * Map a whole file read-only into memory.
+ * (pages are loaded on first touch and shared through the OS page cache,
+ *  so several running copies of the game share one copy of the data)
+ */
+
+struct MappedFile {
+	//NOTE: throws on error
+	explicit MappedFile(std::string const &filename);
+	~MappedFile();
+
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	//the file's bytes; the start is page-aligned (so at least 8-byte aligned):
+	std::span< char const > data() const { return std::span< char const >(bytes, size); }
+
+private:
+	char const *bytes = nullptr;
+	size_t size = 0;
+	#if defined(_WIN32)
+	void *mapping = nullptr; //HANDLE for the file mapping
+	#endif
+};
@@ -0,0 +1,99 @@
+#include "pack_palettes.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+
+//colors as words (the byte order doesn't matter, as long as it round-trips):
+static uint32_t to_word(glm::u8vec4 const &color) {
+	return uint32_t(color.r) | (uint32_t(color.g) << 8) | (uint32_t(color.b) << 16) | (uint32_t(color.a) << 24);
+}
+static glm::u8vec4 to_color(uint32_t word) {
+	return glm::u8vec4(uint8_t(word), uint8_t(word >> 8), uint8_t(word >> 16), uint8_t(word >> 24));
+}
+
+ColorSet ColorSet::from_palette(PPU466::Palette const &palette, uint8_t count) {
+	assert(count <= 4);
+	ColorSet ret;
+	ret.count = count;
+	for (uint32_t i = 0; i < count; ++i) {
+		ret.colors[i] = to_word(palette[i]);
+	}
+	std::sort(ret.colors.begin(), ret.colors.begin() + count);
+	return ret;
+}
+
+size_t ColorSet::Hash::operator()(ColorSet const &set) const {
+	//(sets are sorted, so an order-dependent mix is fine -- and it spreads much better than xor)
+	uint64_t h = set.count;
+	for (uint32_t color : set.colors) {
+		h = (h ^ color) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	return size_t(h);
+}
+
+//union of two sets, or count > 4 if it won't fit in a palette:
+static ColorSet merge(ColorSet const &a, ColorSet const &b) {
+	ColorSet ret;
+	uint32_t i = 0, j = 0;
+	while (i < a.count || j < b.count) {
+		uint32_t color;
+		if (j == b.count || (i < a.count && a.colors[i] < b.colors[j])) {
+			color = a.colors[i++];
+		} else if (i == a.count || b.colors[j] < a.colors[i]) {
+			color = b.colors[j++];
+		} else {
+			color = a.colors[i++];
+			++j;
+		}
+		if (ret.count == 4) {
+			ret.count = 5;
+			break;
+		}
+		ret.colors[ret.count++] = color;
+	}
+	return ret;
+}
+
+std::vector<PPU466::Palette> pack_palettes(std::vector<ColorSet> const &sets, std::vector<size_t> *set_palettes) {
+	assert(set_palettes);
+
+	std::vector<size_t> order(sets.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sets](size_t a, size_t b) {
+		return sets[a].count > sets[b].count;
+	});
+
+	std::vector<ColorSet> packed;
+	set_palettes->assign(sets.size(), 0);
+	for (size_t s : order) {
+		ColorSet const &set = sets[s];
+		size_t best = packed.size();
+		ColorSet best_merged;
+		for (size_t p = 0; p < packed.size(); ++p) {
+			ColorSet merged = merge(packed[p], set);
+			if (merged.count > 4) continue;
+			if (best == packed.size() || merged.count - packed[p].count < best_merged.count - packed[best].count) {
+				best = p;
+				best_merged = merged;
+				if (merged.count == packed[p].count) break; //already contains the set; can't do better
+			}
+		}
+		if (best == packed.size()) {
+			packed.emplace_back(set);
+		} else {
+			packed[best] = best_merged;
+		}
+		(*set_palettes)[s] = best;
+	}
+
+	std::vector<PPU466::Palette> palettes(packed.size());
+	for (size_t p = 0; p < packed.size(); ++p) {
+		palettes[p].fill(glm::u8vec4(0));
+		for (uint32_t i = 0; i < packed[p].count; ++i) {
+			palettes[p][i] = to_color(packed[p].colors[i]);
+		}
+	}
+	return palettes;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "PPU466.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Choose a small set of PPU466::Palettes that covers the colors of many tiles.
+ *
+ * Each tile is described by the set of colors it uses (a ColorSet, at most four).
+ * Tiles whose colors are a subset of another tile's colors can share that tile's palette,
+ *  and tiles with few colors can often share a palette with each other, so the
+ *  number of palettes needed is usually much smaller than the number of distinct sets.
+ */
+
+//the colors one tile uses, as sorted 32-bit words:
+// (so tiles using the same colors in a different order have equal ColorSets)
+struct ColorSet {
+	std::array<uint32_t, 4> colors = {0, 0, 0, 0}; //entries past 'count' are zero
+	uint8_t count = 0;
+
+	//build from the first 'count' entries of a palette, in any order:
+	static ColorSet from_palette(PPU466::Palette const &palette, uint8_t count);
+
+	bool operator==(ColorSet const &other) const = default;
+
+	struct Hash {
+		size_t operator()(ColorSet const &set) const;
+	};
+};
+
+//find palettes covering every set in 'sets', greedily using as few as it can:
+// - sets are placed biggest first (in order of 'sets' among equal sizes, so results are deterministic)
+// - each set goes in the palette that already contains it or, failing that, the one it adds the fewest colors to
+// returns the palettes; set_palettes[i] is the index of the palette covering sets[i]
+// palette colors are sorted as in ColorSet, and unused entries are (0,0,0,0)
+std::vector<PPU466::Palette> pack_palettes(std::vector<ColorSet> const &sets, std::vector<size_t> *set_palettes);
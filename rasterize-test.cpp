@@ -0,0 +1,327 @@
+//rasterize-test draws a few fixed PPU466 states with PPU466::rasterize and compares them to golden images:
+// usage: rasterize-test <golden dir> [--update | --gl]
+// (run by Maekfile.js as part of the ':test' target)
+//
+// '--update' writes the golden images instead of checking them;
+//  do this only after a change that is meant to alter the image, and look at the results before committing them.
+// '--gl' checks PPU466::draw against the same golden images instead -- once for every combination of draw options --
+//  by reading what it drew back with glReadPixels. This needs an OpenGL 3.3 context, so it's the separate ':test-gl' target.
+//  GL doesn't pin down how blending rounds, so translucent pixels may be off by one step per channel; more than that fails.
+// On a mismatch, what was actually drawn is saved next to the golden image as '<name>-failed.png' (or '<name>-gl-failed.png').
+
+#include "PPU466.hpp"
+#include "load_save_png.hpp"
+#include "GL.hpp"
+#include "gl_errors.hpp"
+#include "Load.hpp"
+
+#include <SDL3/SDL.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+	//small fixed random number generator, so scenes are the same on every platform:
+	struct Random {
+		uint32_t state = 1;
+		uint32_t operator()() {
+			state = state * 1664525u + 1013904223u;
+			return state >> 8;
+		}
+	};
+
+	//random tiles, and palettes with a transparent color 0 and some translucent colors:
+	void randomize_tables(PPU466 &ppu, Random &random) {
+		for (auto &tile : ppu.tile_table) {
+			for (uint32_t y = 0; y < 8; ++y) {
+				tile.bit0[y] = uint8_t(random());
+				tile.bit1[y] = uint8_t(random());
+			}
+		}
+		for (uint32_t p = 0; p < ppu.palette_table.size(); ++p) {
+			auto &palette = ppu.palette_table[p];
+			palette[0] = glm::u8vec4(0x00, 0x00, 0x00, 0x00);
+			for (uint32_t c = 1; c < 4; ++c) {
+				uint32_t bits = random();
+				uint8_t alpha = (p % 3 == 2 && c == 1 ? uint8_t(0x40 + (bits >> 16) % 0x80) : 0xff);
+				palette[c] = glm::u8vec4(uint8_t(bits), uint8_t(bits >> 8), uint8_t(bits >> 16), alpha);
+			}
+		}
+	}
+
+	//random tiles, palettes, and flips everywhere on the background:
+	void randomize_background(PPU466 &ppu, Random &random) {
+		for (auto &info : ppu.background) {
+			uint32_t bits = random();
+			info = uint16_t((bits & 0xff) | (((bits >> 8) & (0x07 | PPU466::FlipX | PPU466::FlipY)) << 8));
+		}
+	}
+
+	struct Scene {
+		std::string name;
+		std::function< void(PPU466 &) > setup;
+	};
+
+	std::vector< Scene > const scenes = {
+		//state of a freshly constructed PPU:
+		{"default", [](PPU466 &) {
+		}},
+		//background only, scrolled so it wraps around in both directions:
+		{"background-wrap", [](PPU466 &ppu) {
+			Random random;
+			randomize_tables(ppu, random);
+			randomize_background(ppu, random);
+			ppu.background_color = glm::u8vec3(0x20, 0x30, 0x60);
+			ppu.background_position = glm::ivec2(-1000, 333);
+			for (auto &sprite : ppu.sprites) {
+				sprite.y = 255; //(off screen)
+			}
+		}},
+		//sprites in front of and behind the background, flipped, and clipped by the screen edges:
+		{"sprites", [](PPU466 &ppu) {
+			Random random;
+			random.state = 7;
+			randomize_tables(ppu, random);
+			randomize_background(ppu, random);
+			//leave holes in the background so the sprites behind it show through:
+			for (uint32_t i = 0; i < ppu.background.size(); i += 3) {
+				ppu.background[i] = 0;
+			}
+			std::memset(&ppu.tile_table[0], 0, sizeof(ppu.tile_table[0]));
+			ppu.background_color = glm::u8vec3(0x80, 0x10, 0x10);
+			ppu.background_position = glm::ivec2(37, -5);
+			for (uint32_t i = 0; i < ppu.sprites.size(); ++i) {
+				auto &sprite = ppu.sprites[i];
+				uint32_t bits = random();
+				sprite.x = uint8_t(bits);
+				sprite.y = uint8_t((bits >> 8) % 240);
+				sprite.index = uint8_t(1 + (bits >> 16) % 255);
+				sprite.attributes = uint8_t(((bits >> 24) & (0x07 | PPU466::FlipX | PPU466::FlipY)) | (i % 2 ? 0x80 : 0x00));
+			}
+			//a few at the edges:
+			ppu.sprites[0].x = 252; ppu.sprites[0].y = 100;
+			ppu.sprites[1].x = 0; ppu.sprites[1].y = 236;
+			ppu.sprites[2].x = 255; ppu.sprites[2].y = 0;
+		}},
+	};
+
+	//compare 'pixels' against the golden image for 'scene' (or, if 'update' is set, write it); returns false on mismatch:
+	// ('label' says what drew the image; channels may be off by up to 'tolerance'; on a mismatch the image is saved as '<name><failed>')
+	bool check(std::string const &dir, Scene const &scene, std::string const &label, std::string const &failed,
+		std::vector< glm::u8vec4 > const &pixels, bool update, uint8_t tolerance = 0) {
+		const glm::uvec2 size = glm::uvec2(PPU466::ScreenWidth, PPU466::ScreenHeight);
+		std::string golden = dir + "/" + scene.name + ".png";
+
+		if (update) {
+			save_png(golden, size, pixels.data(), LowerLeftOrigin);
+			std::cout << "Wrote " << golden << " (" << label << ")" << std::endl;
+			return true;
+		}
+
+		glm::uvec2 golden_size;
+		std::vector< glm::u8vec4 > expected;
+		try {
+			load_png(golden, &golden_size, &expected, LowerLeftOrigin);
+		} catch (std::exception &e) {
+			std::cerr << "FAILED " << scene.name << ": " << e.what() << std::endl;
+			return false;
+		}
+		if (golden_size != size) {
+			std::cerr << "FAILED " << scene.name << ": " << golden << " is " << golden_size.x << "x" << golden_size.y << ", not " << size.x << "x" << size.y << "." << std::endl;
+			return false;
+		}
+
+		uint32_t different = 0;
+		uint32_t close = 0; //(different, but within tolerance)
+		uint32_t first = 0;
+		for (uint32_t i = 0; i < pixels.size(); ++i) {
+			if (pixels[i] == expected[i]) continue;
+			bool within = true;
+			for (uint32_t c = 0; c < 4; ++c) {
+				within = within && std::abs(int32_t(pixels[i][c]) - int32_t(expected[i][c])) <= tolerance;
+			}
+			if (within) {
+				close += 1;
+			} else {
+				if (different == 0) first = i;
+				different += 1;
+			}
+		}
+		if (different != 0) {
+			std::string path = dir + "/" + scene.name + failed;
+			save_png(path, size, pixels.data(), LowerLeftOrigin);
+			std::cerr << "FAILED " << scene.name << " (" << label << "): " << different << " pixels differ from " << golden
+				<< " (first at " << first % size.x << "," << first / size.x << "); saved the image drawn to " << path << "." << std::endl;
+			return false;
+		}
+		std::cout << "ok " << scene.name << " (" << label << ")";
+		if (close != 0) std::cout << " -- " << close << " pixels off by at most " << uint32_t(tolerance);
+		std::cout << std::endl;
+		return true;
+	}
+
+	//draw every scene with PPU466::rasterize and check the results:
+	uint32_t test_rasterize(std::string const &dir, bool update) {
+		const glm::uvec2 size = glm::uvec2(PPU466::ScreenWidth, PPU466::ScreenHeight);
+		uint32_t failures = 0;
+		for (Scene const &scene : scenes) {
+			PPU466 ppu;
+			scene.setup(ppu);
+
+			std::vector< glm::u8vec4 > pixels(size.x * size.y);
+			ppu.rasterize(pixels.data());
+
+			//splitting into bands must not change anything:
+			std::vector< glm::u8vec4 > banded(pixels.size());
+			ppu.rasterize(banded.data(), 7);
+			if (banded != pixels) {
+				std::cerr << "FAILED " << scene.name << ": drawing with several threads gives a different image." << std::endl;
+				failures += 1;
+				continue;
+			}
+
+			if (!check(dir, scene, "rasterize", "-failed.png", pixels, update)) failures += 1;
+		}
+		return failures;
+	}
+
+	//draw every scene with PPU466::draw -- using every combination of draw options -- and check the results:
+	// (needs a current OpenGL context, with GL and Load<> functions already set up)
+	uint32_t test_draw(std::string const &dir) {
+		const glm::uvec2 size = glm::uvec2(PPU466::ScreenWidth, PPU466::ScreenHeight);
+
+		//PPU466::draw draws to whatever framebuffer is bound, so bind a screen-sized one that can be read back:
+		GLuint color_rb = 0;
+		glGenRenderbuffers(1, &color_rb);
+		glBindRenderbuffer(GL_RENDERBUFFER, color_rb);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size.x, size.y);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		GLuint fb = 0;
+		glGenFramebuffers(1, &fb);
+		glBindFramebuffer(GL_FRAMEBUFFER, fb);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_rb);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cerr << "FAILED: couldn't make a framebuffer to draw into." << std::endl;
+			return 1;
+		}
+
+		std::vector< std::tuple< PPU466::DrawPath, PPU466::BackgroundPath, PPU466::TileFormat, PPU466::UpscalePath > > options;
+		for (auto draw_path : { PPU466::DrawTriangleStrip, PPU466::DrawInstanced }) {
+			for (auto background_path : { PPU466::BackgroundTiles, PPU466::BackgroundTilemap }) {
+				for (auto tile_format : { PPU466::TilesIndexed, PPU466::TilesPlanar }) {
+					//(UpscaleDirect between UpscaleBlits keeps draw() from just showing the previous frame again)
+					for (auto upscale_path : { PPU466::UpscaleDirect, PPU466::UpscaleBlit }) {
+						options.emplace_back(draw_path, background_path, tile_format, upscale_path);
+					}
+				}
+			}
+		}
+
+		uint32_t failures = 0;
+		for (Scene const &scene : scenes) {
+			for (auto const &[draw_path, background_path, tile_format, upscale_path] : options) {
+				PPU466 ppu;
+				scene.setup(ppu);
+				ppu.draw_path = draw_path;
+				ppu.background_path = background_path;
+				ppu.tile_format = tile_format;
+				ppu.upscale_path = upscale_path;
+
+				std::string label = std::string("draw:")
+					+ (draw_path == PPU466::DrawInstanced ? " instanced" : " triangle strip")
+					+ (background_path == PPU466::BackgroundTilemap ? ", tilemap" : ", tiles")
+					+ (tile_format == PPU466::TilesPlanar ? ", planar" : ", indexed")
+					+ (upscale_path == PPU466::UpscaleBlit ? ", blit" : ", direct");
+
+				ppu.draw(size);
+				if (ppu.draw_stats.reused_previous_frame) {
+					std::cerr << "FAILED " << scene.name << " (" << label << "): showed the previous frame instead of drawing." << std::endl;
+					failures += 1;
+					continue;
+				}
+
+				std::vector< glm::u8vec4 > pixels(size.x * size.y);
+				glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+				GL_ERRORS();
+
+				if (!check(dir, scene, label, "-gl-failed.png", pixels, false, 1)) failures += 1;
+			}
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &fb);
+		glDeleteRenderbuffers(1, &color_rb);
+		GL_ERRORS();
+
+		return failures;
+	}
+}
+
+int main(int argc, char **argv) {
+	bool gl = false;
+	bool update = false;
+	if (argc == 3) {
+		gl = (std::string(argv[2]) == "--gl");
+		update = (std::string(argv[2]) == "--update");
+	}
+	if (!(argc == 2 || gl || update)) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <golden dir> [--update | --gl]" << std::endl;
+		return 1;
+	}
+	std::string dir = argv[1];
+
+	if (!gl) {
+		uint32_t failures = test_rasterize(dir, update);
+		if (failures != 0) {
+			std::cerr << failures << " of " << scenes.size() << " scenes failed." << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	//same context setup as main.cpp, but with a hidden window (nothing is ever shown in it):
+	if (!SDL_Init(SDL_INIT_VIDEO)) {
+		std::cerr << "Error initializing SDL: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+	SDL_GL_ResetAttributes();
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+
+	SDL_Window *window = SDL_CreateWindow("rasterize-test", PPU466::ScreenWidth, PPU466::ScreenHeight, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (!window) {
+		std::cerr << "Error creating SDL window: " << SDL_GetError() << std::endl;
+		SDL_Quit();
+		return 1;
+	}
+	SDL_GLContext context = SDL_GL_CreateContext(window);
+	if (!context) {
+		std::cerr << "Error creating OpenGL context: " << SDL_GetError() << std::endl;
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return 1;
+	}
+
+	init_GL();
+	call_load_functions();
+
+	uint32_t failures = test_draw(dir);
+
+	SDL_GL_DestroyContext(context);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+
+	if (failures != 0) {
+		std::cerr << failures << " drawings of " << scenes.size() << " scenes failed." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,9 +1,21 @@
 #pragma once
 
+#include "lz_block.hpp"
+#include "crc32c.hpp"
+
 #include <iostream>
 #include <vector>
+#include <span>
+#include <string_view>
+#include <cstdint>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <ranges>
+#include <tuple>
+#include <type_traits>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -41,6 +53,48 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 }
 
 
+//zero-copy version of read_chunk for data already in memory (e.g., a MappedFile from mapped_file.hpp):
+// reads the chunk at the start of *from_, points *to_ at its data (no copy), and advances *from_ past it
+// performs the same checks as read_chunk and also requires the data to be suitably aligned for T
+// (*to_ is only valid as long as the memory behind *from_ is)
+template< typename T >
+void read_chunk(std::span< char const > *from_, std::string const &magic, std::span< T const > *to_) {
+	assert(from_);
+	assert(to_);
+	auto &from = *from_;
+	auto &to = *to_;
+
+	struct ChunkHeader {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t size = 0;
+	};
+	static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+
+	ChunkHeader header;
+	if (from.size() < sizeof(header)) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(&header, from.data(), sizeof(header));
+	if (std::string(header.magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (header.size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+
+	if (from.size() - sizeof(header) < header.size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+	char const *data = from.data() + sizeof(header);
+	if (reinterpret_cast< uintptr_t >(data) % alignof(T) != 0) {
+		throw std::runtime_error("Chunk data is not aligned for element type.");
+	}
+
+	to = std::span< T const >(reinterpret_cast< T const * >(data), header.size / sizeof(T));
+	from = from.subspan(sizeof(header) + header.size);
+}
+
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
 void write_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to_) {
@@ -63,3 +117,410 @@ void write_chunk(std::string const &magic, std::vector< T > const &from, std::os
 	to.write(reinterpret_cast< const char * >(&header), sizeof(header));
 	to.write(reinterpret_cast< const char * >(from.data()), from.size() * sizeof(T));
 }
+
+
+//Compressed chunks:
+// same header as above, but the data is compressed (with lz_block.hpp; link lz_block.cpp to use these):
+// |ma|gi|c.|..| <-- four byte "magic number"
+// |sz|sz|sz|sz| <-- four byte size of the compressed data that follows
+// |us|us|us|us| <-- four byte size of the uncompressed data (a multiple of sizeof(T))
+// |bs|bs|bs|bs| |...| * n <-- blocks, each decoding to CompressedChunkBlockSize bytes (except the last);
+//                           bs is the size of the block's data, with the top bit set if it was stored uncompressed
+//
+// blocks are decompressed one at a time directly into the destination, so a stream reader only ever
+// buffers one compressed block.
+
+constexpr uint32_t CompressedChunkBlockSize = 64 * 1024;
+constexpr uint32_t CompressedChunkStoredBit = 0x80000000;
+
+//(used by write_compressed_chunk) the data of a compressed chunk holding 'from':
+template< typename T >
+std::vector< char > compress_chunk_data(std::vector< T > const &from) {
+	char const *src = reinterpret_cast< char const * >(from.data());
+	uint32_t src_size = uint32_t(from.size() * sizeof(T));
+
+	//data is [uncompressed size, blocks...]:
+	std::vector< char > data(4);
+	std::memcpy(data.data(), &src_size, 4);
+	for (uint32_t begin = 0; begin < src_size; begin += CompressedChunkBlockSize) {
+		uint32_t size = std::min(src_size - begin, CompressedChunkBlockSize);
+		size_t header_at = data.size();
+		data.resize(data.size() + 4);
+		lz_compress_block(src + begin, size, &data);
+		uint32_t block = uint32_t(data.size() - header_at - 4);
+		if (block >= size) { //incompressible block: store it instead
+			data.resize(header_at + 4);
+			data.insert(data.end(), src + begin, src + begin + size);
+			block = size | CompressedChunkStoredBit;
+		}
+		std::memcpy(data.data() + header_at, &block, 4);
+	}
+	return data;
+}
+
+template< typename T >
+void write_compressed_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to) {
+	write_chunk(magic, compress_chunk_data(from), to);
+}
+
+//(used by read_compressed_chunk) decompress chunk data, given a function that returns a pointer to the next n bytes of data:
+template< typename T, typename Next >
+void decompress_chunk_data(uint32_t size, Next const &next, std::vector< T > *to_) {
+	auto &to = *to_;
+	if (size < 4) {
+		throw std::runtime_error("Compressed chunk is too small.");
+	}
+	uint32_t dst_size;
+	std::memcpy(&dst_size, next(4), 4);
+	size -= 4;
+	if (dst_size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	//check that the rest of the chunk could possibly hold that much before allocating it (so a damaged size fails here):
+	// every block takes at least its 4-byte header, and no block's data decodes to more than LzMaxExpansion bytes per byte
+	uint64_t blocks = (uint64_t(dst_size) + CompressedChunkBlockSize - 1) / CompressedChunkBlockSize;
+	if (blocks * 4 + (uint64_t(dst_size) + LzMaxExpansion - 1) / LzMaxExpansion > size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+	to.resize(dst_size / sizeof(T));
+	char *dst = reinterpret_cast< char * >(to.data());
+
+	for (uint32_t begin = 0; begin < dst_size; begin += CompressedChunkBlockSize) {
+		uint32_t block_size = std::min(dst_size - begin, CompressedChunkBlockSize);
+		if (size < 4) {
+			throw std::runtime_error("Failed to read chunk data.");
+		}
+		uint32_t block;
+		std::memcpy(&block, next(4), 4);
+		size -= 4;
+		uint32_t stored_size = block & ~CompressedChunkStoredBit;
+		if (size < stored_size) {
+			throw std::runtime_error("Failed to read chunk data.");
+		}
+		char const *src = next(stored_size);
+		size -= stored_size;
+		if (block & CompressedChunkStoredBit) {
+			if (stored_size != block_size) {
+				throw std::runtime_error("Stored block in compressed chunk has the wrong size.");
+			}
+			std::memcpy(dst + begin, src, block_size);
+		} else {
+			lz_decompress_block(src, stored_size, dst + begin, block_size);
+		}
+	}
+	if (size != 0) {
+		throw std::runtime_error("Compressed chunk has extra data.");
+	}
+}
+
+//read a chunk written by write_compressed_chunk, from a stream:
+template< typename T >
+void read_compressed_chunk(std::istream &from, std::string const &magic, std::vector< T > *to_) {
+	assert(to_);
+
+	uint32_t header[2];
+	if (!from.read(reinterpret_cast< char * >(header), sizeof(header))) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	if (std::string(reinterpret_cast< char const * >(header), 4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	std::vector< char > buffer;
+	auto next = [&](uint32_t count) -> char const * {
+		buffer.resize(std::max< size_t >(count, 1));
+		if (!from.read(buffer.data(), count)) {
+			throw std::runtime_error("Failed to read chunk data.");
+		}
+		return buffer.data();
+	};
+	decompress_chunk_data(header[1], next, to_);
+}
+
+//read a chunk written by write_compressed_chunk, from memory (advancing *from_ past it, as with read_chunk):
+template< typename T >
+void read_compressed_chunk(std::span< char const > *from_, std::string const &magic, std::vector< T > *to_) {
+	assert(from_);
+	assert(to_);
+	auto &from = *from_;
+
+	std::span< char const > data;
+	read_chunk(&from, magic, &data);
+	auto next = [&](uint32_t count) -> char const * {
+		char const *ret = data.data();
+		data = data.subspan(count);
+		return ret;
+	};
+	decompress_chunk_data(uint32_t(data.size()), next, to_);
+}
+
+
+//Table of contents:
+// a file of chunks may optionally end with a table of contents that lets a loader jump
+// straight to a chunk (say, one level's tiles) instead of reading everything before it:
+//
+// |...chunks...|
+// |to|c0|sz|sz| ChunkTOC::Entry * (sz/24) <-- one entry per chunk written with a ChunkTOC
+// |to|cn|sz|sz| chars * sz                <-- entry names, concatenated
+// |to|c.|of|fs|                           <-- footer: "toc." + file offset of the "toc0" header
+//
+// loaders that read chunks in order never reach the table, so they keep working unchanged.
+//
+// each entry also holds a CRC-32C checksum of its chunk's data (see crc32c.hpp; link crc32c.cpp to use the table),
+// which verify_chunk checks -- so a truncated or corrupted file fails cleanly at load time.
+
+struct ChunkTOC {
+	struct Entry {
+		char magic[4] = {'\0', '\0', '\0', '\0'};
+		uint32_t offset = 0; //file offset of the chunk's header
+		uint32_t size = 0; //size of the chunk's data (not including the header)
+		uint32_t name_begin = 0, name_end = 0; //range in 'names'
+		uint32_t crc = 0; //crc32c of the chunk's data
+	};
+	static_assert(sizeof(Entry) == 24, "Entry is packed");
+
+	std::vector< Entry > entries;
+	std::vector< char > names;
+
+	//indices of entries, sorted by (magic, name) -- and by position for equal ones -- so find() can binary search:
+	// (built by sort(); read_toc calls it, so only tables still being written are searched in order)
+	std::vector< uint32_t > sorted;
+
+	std::string_view name(Entry const &entry) const {
+		return std::string_view(names.data() + entry.name_begin, entry.name_end - entry.name_begin);
+	}
+
+	//record a chunk whose header starts at file offset 'begin' and whose data ends at 'end':
+	// (throws if the chunk starts or ends past what the table's 32-bit offsets and sizes can hold)
+	void add(std::string const &magic, std::string_view name_, std::streamoff begin, std::streamoff end, uint32_t crc) {
+		assert(magic.size() == 4);
+		if (begin < 0 || begin > std::streamoff(UINT32_MAX) || end - begin - 8 > std::streamoff(UINT32_MAX)) {
+			throw std::runtime_error("Chunk '" + magic + "' is past 4GiB into the file (or larger than 4GiB), which the table of contents can't record.");
+		}
+		Entry &entry = entries.emplace_back();
+		std::memcpy(entry.magic, magic.data(), 4);
+		entry.offset = uint32_t(begin);
+		entry.size = uint32_t(end - begin - 8);
+		entry.name_begin = uint32_t(names.size());
+		names.insert(names.end(), name_.begin(), name_.end());
+		entry.name_end = uint32_t(names.size());
+		entry.crc = crc;
+	}
+
+	//(re)build 'sorted' after adding entries:
+	void sort() {
+		sorted.resize(entries.size());
+		for (uint32_t i = 0; i < sorted.size(); ++i) {
+			sorted[i] = i;
+		}
+		std::sort(sorted.begin(), sorted.end(), [this](uint32_t a, uint32_t b) {
+			return key(entries[a], a) < key(entries[b], b);
+		});
+	}
+
+	//first chunk with the given magic and name, or nullptr if there isn't one:
+	Entry const *find(std::string const &magic, std::string_view name_ = "") const {
+		assert(magic.size() == 4);
+		if (sorted.size() != entries.size()) { //(not sorted since the last add)
+			for (auto const &entry : entries) {
+				if (std::string_view(entry.magic, 4) == magic && name(entry) == name_) return &entry;
+			}
+			return nullptr;
+		}
+		auto wanted = std::make_tuple(std::string_view(magic), name_, uint32_t(0));
+		auto it = std::lower_bound(sorted.begin(), sorted.end(), wanted, [this](uint32_t a, auto const &b) {
+			return key(entries[a], a) < b;
+		});
+		if (it == sorted.end() || std::string_view(entries[*it].magic, 4) != magic || name(entries[*it]) != name_) return nullptr;
+		return &entries[*it];
+	}
+
+private:
+	std::tuple< std::string_view, std::string_view, uint32_t > key(Entry const &entry, uint32_t index) const {
+		return std::make_tuple(std::string_view(entry.magic, 4), name(entry), index);
+	}
+};
+
+//write_chunk / write_compressed_chunk that also record the chunk (with a name, which may be empty) in a table of contents:
+template< typename T >
+void write_chunk(std::string const &magic, std::string_view name, std::vector< T > const &from, std::ostream *to, ChunkTOC *toc) {
+	assert(to);
+	assert(toc);
+	std::streamoff begin = to->tellp();
+	write_chunk(magic, from, to);
+	toc->add(magic, name, begin, to->tellp(), crc32c(from.data(), from.size() * sizeof(T)));
+}
+
+template< typename T >
+void write_compressed_chunk(std::string const &magic, std::string_view name, std::vector< T > const &from, std::ostream *to, ChunkTOC *toc) {
+	write_chunk(magic, name, compress_chunk_data(from), to, toc);
+}
+
+//check a chunk against its table of contents entry -- the header's magic and size, then the data's checksum:
+// 'from' is the whole file (as given to read_toc); throws if anything doesn't match
+inline void verify_chunk(std::span< char const > from, ChunkTOC::Entry const &entry) {
+	if (uint64_t(entry.offset) + 8 + entry.size > from.size()) {
+		throw std::runtime_error("Chunk '" + std::string(entry.magic, 4) + "' is out of range.");
+	}
+	//(the header isn't covered by the checksum, and readers trust its size)
+	uint32_t header[2]; //magic, size
+	std::memcpy(header, from.data() + entry.offset, sizeof(header));
+	if (std::memcmp(&header[0], entry.magic, 4) != 0 || header[1] != entry.size) {
+		throw std::runtime_error("Chunk '" + std::string(entry.magic, 4) + "' is corrupted (header doesn't match table of contents).");
+	}
+	if (crc32c(from.data() + entry.offset + 8, entry.size) != entry.crc) {
+		throw std::runtime_error("Chunk '" + std::string(entry.magic, 4) + "' is corrupted (checksum mismatch).");
+	}
+}
+
+//write the table of contents (should be the last thing in the file):
+inline void write_toc(ChunkTOC const &toc, std::ostream *to_) {
+	assert(to_);
+	auto &to = *to_;
+
+	char footer[8] = {'t', 'o', 'c', '.'};
+	std::streamoff begin = to.tellp();
+	if (begin < 0 || begin > std::streamoff(UINT32_MAX)) {
+		throw std::runtime_error("Table of contents would start past 4GiB into the file, which its 32-bit offset can't hold.");
+	}
+	uint32_t offset = uint32_t(begin);
+	std::memcpy(footer + 4, &offset, 4);
+
+	write_chunk("toc0", toc.entries, &to);
+	write_chunk("tocn", toc.names, &to);
+	to.write(footer, sizeof(footer));
+}
+
+//(used by read_toc) parse the "toc0" and "tocn" chunks that start at file offset 'offset':
+inline void parse_toc(std::span< char const > table, uint32_t offset, ChunkTOC *toc_) {
+	assert(toc_);
+	auto &toc = *toc_;
+
+	//copied out (rather than referenced in place) since the table needn't be aligned:
+	std::span< char const > entries, names;
+	read_chunk(&table, "toc0", &entries);
+	read_chunk(&table, "tocn", &names);
+	if (entries.size() % sizeof(ChunkTOC::Entry) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	toc.entries.resize(entries.size() / sizeof(ChunkTOC::Entry));
+	std::memcpy(toc.entries.data(), entries.data(), entries.size());
+	toc.names.assign(names.begin(), names.end());
+
+	for (auto const &entry : toc.entries) {
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= toc.names.size())) {
+			throw std::runtime_error("Table of contents has out-of-range name.");
+		}
+		if (uint64_t(entry.offset) + 8 + entry.size > offset) {
+			throw std::runtime_error("Table of contents has out-of-range chunk.");
+		}
+	}
+	toc.sort();
+}
+
+//read the table of contents from the end of a file of chunks:
+// returns false if the file doesn't have one; throws if it has a malformed one
+// (the span version expects the whole file)
+inline bool read_toc(std::span< char const > from, ChunkTOC *toc) {
+	uint32_t footer[2]; //"toc.", offset
+	if (from.size() < sizeof(footer)) return false;
+	std::memcpy(footer, from.data() + from.size() - sizeof(footer), sizeof(footer));
+	if (std::memcmp(footer, "toc.", 4) != 0) return false;
+
+	size_t end = from.size() - sizeof(footer);
+	if (footer[1] > end) {
+		throw std::runtime_error("Table of contents offset is out of range.");
+	}
+	parse_toc(from.subspan(footer[1], end - footer[1]), footer[1], toc);
+	return true;
+}
+
+inline bool read_toc(std::istream &from, ChunkTOC *toc) {
+	uint32_t footer[2]; //"toc.", offset
+	from.seekg(0, std::ios::end);
+	std::streamoff size = from.tellg();
+	if (size < std::streamoff(sizeof(footer))) return false;
+	from.seekg(size - sizeof(footer));
+	if (!from.read(reinterpret_cast< char * >(footer), sizeof(footer))) {
+		throw std::runtime_error("Failed to read table of contents footer.");
+	}
+	if (std::memcmp(footer, "toc.", 4) != 0) return false;
+
+	std::streamoff end = size - sizeof(footer);
+	if (footer[1] > end) {
+		throw std::runtime_error("Table of contents offset is out of range.");
+	}
+	std::vector< char > table(size_t(end - footer[1]));
+	from.seekg(footer[1]);
+	if (!from.read(table.data(), table.size())) {
+		throw std::runtime_error("Failed to read table of contents.");
+	}
+	parse_toc(std::span< char const >(table), footer[1], toc);
+	return true;
+}
+
+
+//ChunkWriter writes a chunk a piece at a time, for when the data isn't (or shouldn't all be) in memory at once:
+// writes a header with a placeholder size when opened and goes back to fill in the size on close()
+// (so 'to' must be seekable, e.g. a std::ofstream)
+//
+//  ChunkWriter chunk("idx0", &out);
+//  for (auto const &thing : things) chunk.write(thing.index);
+//  chunk.close();
+//
+struct ChunkWriter {
+	ChunkWriter(std::string const &magic, std::ostream *to_) : ChunkWriter(magic, "", to_, nullptr) { }
+	//also record the chunk in a table of contents when closed:
+	ChunkWriter(std::string const &magic_, std::string_view name_, std::ostream *to_, ChunkTOC *toc_) : magic(magic_), name(name_), to(to_), toc(toc_) {
+		assert(magic.size() == 4);
+		assert(to);
+		begin = to->tellp();
+		char header[8] = {magic[0], magic[1], magic[2], magic[3], '\0', '\0', '\0', '\0'};
+		to->write(header, sizeof(header));
+	}
+	~ChunkWriter() {
+		//(an unclosed chunk is only expected if writing was abandoned by an exception)
+		assert((!to || std::uncaught_exceptions()) && "ChunkWriter should be closed before being destroyed");
+	}
+	ChunkWriter(ChunkWriter const &) = delete;
+	ChunkWriter &operator=(ChunkWriter const &) = delete;
+
+	//a single value (containers have to be passed as spans, so their elements get written rather than their pointers):
+	template< typename T >
+	requires (std::is_trivially_copyable_v< T > && !std::ranges::range< T >)
+	void write(T const &value) {
+		write(std::span< T const >(&value, 1));
+	}
+	template< typename T >
+	requires std::is_trivially_copyable_v< T >
+	void write(std::span< T const > values) {
+		assert(to && "can't write to a closed ChunkWriter");
+		to->write(reinterpret_cast< const char * >(values.data()), values.size_bytes());
+		if (toc) crc = crc32c(values.data(), values.size_bytes(), crc);
+	}
+
+	//go back and write the size:
+	// (throws if the chunk got too big for the header's 32-bit size)
+	void close() {
+		assert(to && "ChunkWriter closed twice");
+		std::streamoff end = to->tellp();
+		if (end - begin - 8 > std::streamoff(UINT32_MAX)) {
+			to = nullptr;
+			throw std::runtime_error("Chunk '" + magic + "' is larger than 4GiB.");
+		}
+		uint32_t size = uint32_t(end - begin - 8);
+		to->seekp(begin + 4);
+		to->write(reinterpret_cast< const char * >(&size), 4);
+		to->seekp(end);
+		if (toc) toc->add(magic, name, begin, end, crc);
+		to = nullptr;
+	}
+
+private:
+	std::string magic;
+	std::string name;
+	std::ostream *to;
+	ChunkTOC *toc;
+	std::streamoff begin = 0;
+	uint32_t crc = 0; //of everything written so far (only if there's a toc)
+};
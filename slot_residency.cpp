@@ -0,0 +1,65 @@
+#include "slot_residency.hpp"
+
+#include <cassert>
+
+SlotResidency::SlotResidency(uint32_t slot_count, uint32_t globals) : slots(slot_count), slot_of(globals, None) {
+	//every slot starts out empty and unreferenced:
+	for (uint32_t s = 0; s < slot_count; ++s) {
+		push_newest(s);
+	}
+}
+
+uint32_t SlotResidency::acquire(uint32_t global, bool *load) {
+	assert(global < slot_of.size());
+	assert(load);
+	*load = false;
+
+	uint32_t s = slot_of[global];
+	if (s == None) {
+		//take the slot released longest ago (if any):
+		if (oldest == None) {
+			++overflows;
+			return NoSlot;
+		}
+		s = oldest;
+		if (slots[s].global != None) slot_of[slots[s].global] = None;
+		slots[s].global = global;
+		slot_of[global] = s;
+		*load = true;
+		++loads;
+	}
+
+	if (slots[s].references++ == 0) {
+		unlink(s);
+		++referenced_slots;
+	}
+	return s;
+}
+
+void SlotResidency::release(uint32_t s) {
+	if (s == NoSlot) return;
+	assert(s < slots.size());
+	assert(slots[s].references > 0 && "released more often than acquired");
+	if (--slots[s].references == 0) {
+		push_newest(s);
+		--referenced_slots;
+	}
+}
+
+void SlotResidency::unlink(uint32_t s) {
+	Slot &slot = slots[s];
+	if (slot.prev != None) slots[slot.prev].next = slot.next;
+	else oldest = slot.next;
+	if (slot.next != None) slots[slot.next].prev = slot.prev;
+	else newest = slot.prev;
+	slot.prev = slot.next = None;
+}
+
+void SlotResidency::push_newest(uint32_t s) {
+	Slot &slot = slots[s];
+	slot.prev = newest;
+	slot.next = None;
+	if (newest != None) slots[newest].next = s;
+	else oldest = s;
+	newest = s;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * SlotResidency -- which of many global tiles (or palettes) are in which of a few PPU466 table slots.
+ *
+ * Every use of a global index (a background cell, a sprite) holds a reference to the slot it's in.
+ * Slots nobody references stay loaded, in case they're wanted again soon, until a newly wanted index
+ *  needs the room; the slot released longest ago goes first.
+ * Slots don't move while referenced, so the PPU only re-uploads slots that actually get new contents.
+ */
+
+struct SlotResidency {
+	//'slots' slots for global indices [0, globals):
+	SlotResidency(uint32_t slots, uint32_t globals);
+
+	static constexpr uint32_t NoSlot = ~0u;
+
+	//add a reference to 'global' and return its slot:
+	// if it wasn't resident, *load is set to true and the caller must put its contents in the slot
+	// if every slot is referenced, returns NoSlot (and counts an overflow)
+	uint32_t acquire(uint32_t global, bool *load);
+
+	//drop a reference returned by acquire (NoSlot is ignored):
+	void release(uint32_t slot);
+
+	//running totals, for reporting:
+	uint32_t loads = 0; //acquires that needed the slot's contents loaded
+	uint32_t overflows = 0; //acquires that failed for lack of slots
+
+	uint32_t referenced() const { return referenced_slots; }
+
+private:
+	static constexpr uint32_t None = ~0u;
+
+	struct Slot {
+		uint32_t global = None; //index resident in this slot
+		uint32_t references = 0;
+		//unreferenced slots are kept in a list, oldest release first:
+		uint32_t prev = None, next = None;
+	};
+	std::vector< Slot > slots;
+	std::vector< uint32_t > slot_of; //global index -> slot, or None
+	uint32_t oldest = None, newest = None; //ends of the unreferenced list
+	uint32_t referenced_slots = 0;
+
+	void unlink(uint32_t slot);
+	void push_newest(uint32_t slot);
+};